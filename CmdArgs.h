@@ -1,12 +1,52 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
-#include <iostream>
+#include <unordered_map>
 #include <filesystem>
 #include <algorithm>
 #include <cctype>
 #include <stdexcept>
 #include <cstdlib>
+#include <cstdint>
+#include <cerrno>
+#include <type_traits>
+#include <charconv>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <cstring>
+#include <cstdio>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <array>
+#include <chrono>
+#include <limits>
+#include <initializer_list>
+#include <memory>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+#endif
 
 /*----------------------------------------------------------------
   CmdArgs.h
@@ -33,82 +73,387 @@ namespace cmd
 		AcceptsOnlySourceAndTargetFiles,
 		TooManyArguments,
 		UnknownFlag,
+		InvalidOptionValue,
 		SourceNotFound,
+		SourceDirectoryNotReadable,
+		ArgumentFileNotReadable,
 		SourceInvalidExtension,
 		TargetFileUnknownDirectory,
 		TargetDirectoryDoesNotExist,
 		TargetInvalidExtension,
 		SourceAndTargetAreSame,
-		CannotCombineSourceDirectoryAndTargetFile
+		CannotCombineSourceDirectoryAndTargetFile,
+		TargetDirectoryNotCreated,
+		WatchNeedsSourceDirectory,
+		SourceDirectoryNotWatched,
+		JournalNotReadable,
+		JournalNotWritten,
+		TargetCollision,
+		SourceNotReadable,
+		TooManyOpenFiles
+	};
+
+	// How a parser hands out its results
+	enum class Mode
+	{
+		Global,	// Results go to the cmd:: globals, errors are printed and help/version exit the process
+		Local	// Results stay in the parser (see result()); nothing is printed and the process never exits
+	};
+
+	// Outcome of a parse
+	enum class Status
+	{
+		Ok,
+		Error,	// message holds the error text
+		Help,	// message holds the help text
+		Version	// message holds the version text
+	};
+
+	// Names and default texts of flags and options. A string literal is taken as an array,
+	// so its length is known without strlen and the flag or option that holds it is
+	// constant-initialized (compilers do not fold strlen in an implicit string_view
+	// conversion when deciding static initialization).
+	struct cmd_literal : std::string_view
+	{
+		template <size_t N>
+		constexpr cmd_literal(const char (&text)[N]) : std::string_view(text, N - 1) {}
+		constexpr cmd_literal(std::string_view text) : std::string_view(text) {}
+		constexpr cmd_literal() = default;
 	};
 
+	// Flags are constant-initialized: the name is a view of a string literal.
 	struct cmd_flag
 	{
-		cmd_flag(std::string flag, bool on = false)
-			: _flag(std::move(flag)), on(on), defaultOn(on) {
+		constexpr cmd_flag(cmd_literal flag, bool on = false)
+			: _flag(flag), on(on), defaultOn(on) {
 		}
 
 		void clear() { on = defaultOn; }
 
 		operator bool() const { return on; }
-		operator std::string() const { return _flag; }
+		operator std::string() const { return std::string(_flag); }
 
 		void operator=(bool set) { on = set; }
 
-		const std::string& name() const { return _flag; }
+		constexpr std::string_view name() const { return _flag; }
+		constexpr bool byDefault() const { return defaultOn; }
 	private:
-		const std::string _flag;
+		std::string_view _flag;
 		bool on = false;
 		bool defaultOn = false;
 	};
 
-	std::string join(const std::vector<std::string>& v, const char* delim);
+	// Kind of value an option takes
+	enum class OptionKind
+	{
+		Integer,	// -jobs=8
+		Size,		// bytes, with an optional K, M, G or T suffix (1024 based): -chunk=4M
+		Duration,	// milliseconds, with an optional ms, s, m or h suffix: -timeout=30s
+		Enum,		// one of the option's choices, stored as its index: -mode=fast
+		String		// any text: -name=value
+	};
+
+	// Parsed value of an option: a number for every kind but String, which keeps the text
+	// (a view of the parser's copy of the argument, see cmd_result::strings; the global
+	// options view a copy of their own that outlives the parser)
+	struct cmd_value
+	{
+		long long number = 0;
+		std::string_view text;
+	};
+
+	// Option given as -name=value or -name value. The kind decides how the value is
+	// parsed; numbers are read with std::from_chars (no locale, no allocation).
+	// Use the typed options below (cmd_int, cmd_size, cmd_duration, cmd_enum, cmd_string).
+	// Like flags, options are constant-initialized.
+	struct cmd_option
+	{
+		constexpr cmd_option(cmd_literal option, OptionKind kind, long long number = 0, cmd_literal text = {},
+			const std::string_view* choices = nullptr, size_t countChoices = 0)
+			: _option(option), _kind(kind), _choices(choices), _countChoices(countChoices),
+			value{ number, text }, defaultValue{ number, text } {
+		}
+
+		void clear() { value = defaultValue; }
+
+		operator long long() const { return value.number; }
+
+		void operator=(long long set) { value.number = set; }
+		void operator=(const cmd_value& set) { value = set; }
+
+		constexpr std::string_view name() const { return _option; }
+		constexpr OptionKind kind() const { return _kind; }
+		constexpr const cmd_value& byDefault() const { return defaultValue; }
+
+		// Choices of an Enum option
+		constexpr size_t countChoices() const { return _countChoices; }
+		constexpr std::string_view choice(size_t i) const { return _choices[i]; }
+
+		// Text of a String option, or the name of the selected Enum choice
+		std::string_view text() const { return text(value); }
+
+		std::string_view text(const cmd_value& v) const
+		{
+			if (_kind == OptionKind::Enum && v.number >= 0 && static_cast<size_t>(v.number) < _countChoices)
+				return _choices[static_cast<size_t>(v.number)];
+			return v.text;
+		}
+
+		// Parses text into v without touching the option itself.
+		bool parse(std::string_view text, cmd_value& v) const
+		{
+			switch (_kind)
+			{
+			case OptionKind::Integer:
+				return parseNumber(text, v.number, {});
+			case OptionKind::Size:
+				return parseNumber(text, v.number, { { "", 1 }, { "K", 1ll << 10 }, { "M", 1ll << 20 }, { "G", 1ll << 30 }, { "T", 1ll << 40 } }) && v.number >= 0;
+			case OptionKind::Duration:
+				return parseNumber(text, v.number, { { "", 1 }, { "ms", 1 }, { "s", 1000 }, { "m", 60000 }, { "h", 3600000 } }) && v.number >= 0;
+			case OptionKind::Enum:
+			{
+				const auto it = std::find(_choices, _choices + _countChoices, text);
+				v.number = it - _choices;
+				return it != _choices + _countChoices;
+			}
+			case OptionKind::String:
+				v.text = text;
+				return true;
+			}
+			return false;
+		}
+
+	private:
+		struct unit
+		{
+			std::string_view suffix;
+			long long scale;
+		};
+
+		// A number followed by one of the units (case-insensitive); no units means a plain integer.
+		static bool parseNumber(std::string_view text, long long& v, std::initializer_list<unit> units)
+		{
+			const char* first = text.data();
+			const char* last = first + text.size();
+			const auto r = std::from_chars(first, last, v);
+			if (r.ec != std::errc())
+				return false;
+
+			const std::string_view suffix(r.ptr, static_cast<size_t>(last - r.ptr));
+			if (units.size() == 0)
+				return suffix.empty();
+
+			auto lower = [](char c) { return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c; };
+
+			for (const auto& u : units)
+			{
+				if (suffix.size() != u.suffix.size() ||
+					!std::equal(suffix.begin(), suffix.end(), u.suffix.begin(), [&](char a, char b) { return lower(a) == lower(b); }))
+					continue;
+
+				if (v > (std::numeric_limits<long long>::max)() / u.scale || v < (std::numeric_limits<long long>::min)() / u.scale)
+					return false;
+
+				v *= u.scale;
+				return true;
+			}
+			return false;
+		}
+
+		std::string_view _option;
+		OptionKind _kind;
+		const std::string_view* _choices;
+		size_t _countChoices;
+		cmd_value value;
+		cmd_value defaultValue;
+	};
+
+	// Integer option: -jobs=8
+	struct cmd_int : cmd_option
+	{
+		constexpr cmd_int(cmd_literal option, long long value = 0)
+			: cmd_option(option, OptionKind::Integer, value) {
+		}
+		using cmd_option::operator=;
+	};
+
+	// Size in bytes: -chunk=4M
+	struct cmd_size : cmd_option
+	{
+		constexpr cmd_size(cmd_literal option, long long bytes = 0)
+			: cmd_option(option, OptionKind::Size, bytes) {
+		}
+		using cmd_option::operator=;
+	};
+
+	// Duration in milliseconds: -timeout=30s
+	struct cmd_duration : cmd_option
+	{
+		constexpr cmd_duration(cmd_literal option, std::chrono::milliseconds value = std::chrono::milliseconds(0))
+			: cmd_option(option, OptionKind::Duration, value.count()) {
+		}
+		using cmd_option::operator=;
+
+		std::chrono::milliseconds duration() const { return std::chrono::milliseconds(static_cast<long long>(*this)); }
+	};
+
+	// One of a fixed set of names, stored as the index of the choice: -mode=fast
+	// The choices are viewed, so they must outlive the option (a constexpr array).
+	struct cmd_enum : cmd_option
+	{
+		template <size_t N>
+		constexpr cmd_enum(cmd_literal option, const std::array<std::string_view, N>& choices, size_t value = 0)
+			: cmd_option(option, OptionKind::Enum, static_cast<long long>(value), {}, choices.data(), N) {
+		}
+		using cmd_option::operator=;
+	};
+
+	// Free text: -name=value
+	struct cmd_string : cmd_option
+	{
+		constexpr cmd_string(cmd_literal option, cmd_literal value = {})
+			: cmd_option(option, OptionKind::String, 0, value) {
+		}
+		using cmd_option::operator=;
+	};
+
+	class source_file;
+
+	// A parsed source file and the target file it should be written to
+	struct cmd_pair
+	{
+		std::filesystem::path source;
+		std::filesystem::path target;
+		std::shared_ptr<const source_file> file = nullptr;	// the open source, only with openSources
+
+		// Position of the (source, target) extension pair in a dispatch table (see make_dispatch)
+		static constexpr uint16_t none = 0xffff;
+		uint16_t conversion = none;
+	};
+
+	// A source that was left out by -keepgoing, with the reason
+	struct cmd_error
+	{
+		Msg msg;
+		size_t index = 0;	// 0-based position among the source arguments (after @file expansion), the stdin line, or the pair (TargetCollision)
+		std::filesystem::path path;
+	};
+
+	// Receives what a Global mode parser prints: errors (Status::Error) and help or version text
+	using output_callback = void (*)(Status status, std::string_view text);
+
+	// Default output: errors to stderr, help and version to stdout, through stdio (no iostreams)
+	inline void writeOutput(Status status, std::string_view text)
+	{
+		std::FILE* out = status == Status::Error ? stderr : stdout;
+		std::fwrite(text.data(), 1, text.size(), out);
+		std::fflush(out);
+	}
+
+	// Fixed-size list for the setup below: make_list<std::string_view>("txt", "csv")
+	template <class T, class... A>
+	constexpr std::array<T, sizeof...(A)> make_list(A... items)
+	{
+		return { { T(items)... } };
+	}
+
+	template <class List>
+	std::string join(const List& v, const char* delim);
 
 	//-[ CmdArgs Setup for Your Program ]----------------------------------------------------------------------
 
+	// Everything in this section except the help text is constant-initialized, so no
+	// code runs for it before main.
+
 	// Set your program name and version here
-	inline std::string text_version = "MyProgram version: 1.0.0";
+	inline constexpr std::string_view text_version = "MyProgram version: 1.0.0";
 
 	// Set your accepted source and target extensions here (first is default)
-	inline const std::vector<std::string> source_ext = { "txt", "csv", "json" };
-	inline const std::vector<std::string> target_ext = { "csv", "json", "txt" };
+	inline constexpr auto source_ext = make_list<std::string_view>("txt", "csv", "json");
+	inline constexpr auto target_ext = make_list<std::string_view>("csv", "json", "txt");
 
 	// Set your command line flags here (true means you enable the flag by default)
 	inline cmd_flag convert{ "convert", true };
 	inline cmd_flag translate{ "translate" };
 	inline cmd_flag help{ "help" };
 	inline cmd_flag version{ "version" };
+	inline cmd_flag recursive{ "recursive" };	// Used by the parser: include subdirectories of a source directory
+	inline cmd_flag incremental{ "incremental" };	// Used by the parser: skip sources whose target is up to date
+	inline cmd_flag keepgoing{ "keepgoing" };	// Used by the parser: record bad sources in errors and go on with the rest
+	inline cmd_flag largestfirst{ "largestfirst" };	// Used by the parser: order the pairs by source size, largest first
+	inline cmd_flag watch{ "watch" };	// Used by run(): go on converting the sources of a source directory as they change
 
 	// Register your flags here (help and version must be included)
-	inline const std::vector<cmd_flag*> cmd_flags = { &convert, &translate, &help, &version };
-
-	// Define your help text here
-	inline std::string text_help = []()
-		{
-			std::string s;
-
-			s += "\nUsage: MyProgram [options] <source_path> [target_path]\n\n";
-			s += "Options:\n\n";
-			s += "  -convert      : Convert the source to the target format (default : on)\n";
-			s += "  -translate    : Enable translation (must be specified)\n";
-			s += "  -help         : Show this help message\n";
-			s += "  -version      : Show version information\n";
-			s += "\n";
-			s += "File extensions:\n\n";
-			s += "  Source: ";
-			s += join(source_ext, ", ");
-			s += "\n";
-			s += "  Target: ";
-			s += join(target_ext, ", ");
-			s += "\n\n";
-			s += "Notes:\n\n";
-			s += "  Paths are resolved relative to the current working directory.\n";
-			s += "  If target_path is given without a directory, it is placed next to the source file.\n";
-			s += "  If target_path is a directory, output is placed in that directory.\n";
-			s += "  If target_path is omitted, the output name is derived from the source file.\n";
-			s += "  Example:  input.txt  ->  input.csv\n";
-			return s;
-		}();
+	inline constexpr auto cmd_flags = make_list<cmd_flag*>(&convert, &translate, &help, &version, &recursive, &incremental, &keepgoing, &largestfirst, &watch);
+
+	// Set your command line options here (options take a value: -name=value, see cmd_option)
+	inline cmd_int jobs{ "jobs", 0 };	// Used by run(): number of worker threads (0 means all cores)
+	inline cmd_string shard{ "shard" };	// Used by the parser: -shard=i/n keeps the sources of shard i (0 based) of n
+	inline cmd_int readahead{ "readahead", 0 };	// Used by run(): sources ahead of the workers to prefetch into the cache
+	inline cmd_string resume{ "resume" };	// Used by the parser and run(): -resume=FILE skips the pairs an earlier run finished
+	inline constexpr auto plan_formats = make_list<std::string_view>("none", "jsonl", "nul");	// in the order of PlanFormat
+	inline cmd_enum plan{ "plan", plan_formats };	// Used by run(): -plan=jsonl|nul prints the pairs instead of converting them
+	inline cmd_duration rescan{ "rescan", std::chrono::seconds(5) };	// Used by run(): -watch rescans the tree this often where the system sends no change notifications
+
+	// Register your options here
+	inline constexpr auto cmd_options = make_list<cmd_option*>(&jobs, &shard, &readahead, &resume, &plan, &rescan);
+
+	// Set to false to accept only one source (and one target) per command line
+	inline const bool accept_batch = true;
+
+	// Set your own output function here to route errors, help and version text elsewhere
+	inline output_callback cmd_output = writeOutput;
+
+	// Define your help text here (built on first use, not at startup)
+	inline const std::string& text_help()
+	{
+		static const std::string text = []()
+			{
+				std::string s;
+
+				s += "\nUsage: MyProgram [options] <source_path>... [target_path]\n\n";
+				s += "Options:\n\n";
+				s += "  -convert      : Convert the source to the target format (default : on)\n";
+				s += "  -translate    : Enable translation (must be specified)\n";
+				s += "  -help         : Show this help message\n";
+				s += "  -version      : Show version information\n";
+				s += "  -recursive    : Include subdirectories when the source is a directory\n";
+				s += "  -incremental  : Skip sources whose target is newer than the source\n";
+				s += "  -keepgoing    : Report invalid sources but go on with the valid ones\n";
+				s += "  -largestfirst : Start the largest source files first\n";
+				s += "  -watch        : Keep converting sources of the source directory as they are created or modified\n";
+				s += "  -jobs=N       : Number of files processed in parallel (default : all cores)\n";
+				s += "  -shard=I/N    : Process only the sources of shard I of N (I from 0 to N-1)\n";
+				s += "  -readahead=K  : Let the system read the next K sources while the current ones run\n";
+				s += "  -resume=FILE  : Record finished files in FILE and skip them when run again\n";
+				s += "  -plan=FORMAT  : Print source, target and size of every file (jsonl or nul) and convert nothing\n";
+				s += "  -rescan=TIME  : Rescan interval of -watch without change notifications (default : 5s)\n";
+				s += "\n";
+				s += "File extensions:\n\n";
+				s += "  Source: ";
+				s += join(source_ext, ", ");
+				s += "\n";
+				s += "  Target: ";
+				s += join(target_ext, ", ");
+				s += "\n\n";
+				s += "Notes:\n\n";
+				s += "  Paths are resolved relative to the current working directory.\n";
+				s += "  If target_path is a file given without a directory, it is placed next to the source file.\n";
+				s += "  If target_path is a directory, output is placed in that directory (relative to the\n";
+				s += "  current working directory, with one source or several).\n";
+				s += "  If target_path is omitted, the output name is derived from the source file.\n";
+				s += "  If source_path is a directory, all files with a source extension are used.\n";
+				s += "  A source directory with a target directory is mirrored into the target directory.\n";
+				s += "  With -watch the program runs until it is stopped (Ctrl+C).\n";
+				s += "  If several source paths are given, target_path must be a directory (or omitted).\n";
+				s += "  @file reads more arguments from file, one argument per line.\n";
+				s += "  A source_path of - reads the source paths from stdin, one per line.\n";
+				s += "  Example:  input.txt  ->  input.csv\n";
+				return s;
+			}();
+
+		return text;
+	}
 
 	//-[ CmdArgs Messages ]--------------------------------------------------------------------
 
@@ -130,8 +475,14 @@ namespace cmd
 			return "Too many arguments";
 		case Msg::UnknownFlag:
 			return "Unknown flag " + s;
+		case Msg::InvalidOptionValue:
+			return "Invalid value for option " + s;
 		case Msg::SourceNotFound:
 			return "Could not find the source file " + p.string();
+		case Msg::SourceDirectoryNotReadable:
+			return "Could not read the source directory " + p.string();
+		case Msg::ArgumentFileNotReadable:
+			return "Could not read the argument file " + p.string();
 		case Msg::SourceInvalidExtension:
 			return "Source file is not a valid extension: " + p.string();
 		case Msg::TargetFileUnknownDirectory:
@@ -144,6 +495,22 @@ namespace cmd
 			return "Source and target files are the same";
 		case Msg::CannotCombineSourceDirectoryAndTargetFile:
 			return "Cannot combine source directory and target file";
+		case Msg::TargetDirectoryNotCreated:
+			return "Could not create the target directory " + p.string();
+		case Msg::WatchNeedsSourceDirectory:
+			return "The -watch flag needs a source directory";
+		case Msg::SourceDirectoryNotWatched:
+			return "Could not watch the source directory " + p.string();
+		case Msg::JournalNotReadable:
+			return "Could not read the resume journal " + p.string();
+		case Msg::JournalNotWritten:
+			return "Could not write the resume journal " + p.string();
+		case Msg::TargetCollision:
+			return "Several sources have the same target " + p.string();
+		case Msg::SourceNotReadable:
+			return "Could not read the source file " + p.string();
+		case Msg::TooManyOpenFiles:
+			return "Too many open files to open the source file " + p.string();
 		default:
 			return "Unknown error";
 		}
@@ -156,33 +523,57 @@ namespace cmd
 	inline std::filesystem::path source;
 	inline std::filesystem::path target;
 
+	// All accepted source files. In source directory mode this is the expanded directory content.
+	inline std::vector<std::filesystem::path> sources;
+
+	// All accepted (source, target) pairs, one per source file.
+	inline std::vector<cmd_pair> pairs;
+
+	// Sources left out by -keepgoing (they are printed as well).
+	inline std::vector<cmd_error> errors;
+
 	// Function to get the default extension (the first in the list)
-	static std::string defaultExt(const std::vector<std::string>& list)
+	template <class List>
+	constexpr std::string_view defaultExt(const List& list)
 	{
-		return list.empty() ? std::string() : list.front();
+		return list.empty() ? std::string_view() : list.front();
 	}
 
 	// Returns the default source extension (from the source_ext list)
-	static std::string defaultSourceExt()
+	constexpr std::string_view defaultSourceExt()
 	{
 		return defaultExt(source_ext);
 	}
 
 	// Returns the default target extension (from the target_ext list)
-	static std::string defaultTargetExt()
+	constexpr std::string_view defaultTargetExt()
 	{
 		return defaultExt(target_ext);
 	}
 
 	//-----------------------------------------------------------------------------------------
 
-	inline std::string tolower(std::string txt)
+	inline std::string tolower(std::string_view view)
 	{
+		std::string txt(view);
 		std::transform(txt.begin(), txt.end(), txt.begin(),
 			[](unsigned char c) { return static_cast<char>(std::tolower(c)); });
 		return txt;
 	}
 
+	// Where a file name starts in a path string: after /, and on Windows also after \ or
+	// the : of a drive (C:name), as path::filename splits it. Every hand-written path split
+	// in this file goes through it.
+	template <class C>
+	constexpr bool isSeparator(C c)
+	{
+#ifdef _WIN32
+		return c == '/' || c == '\\' || c == ':';
+#else
+		return c == '/';
+#endif
+	}
+
 	inline std::string getExtension(const std::filesystem::path& file)
 	{
 		auto ext = tolower(file.extension().string());
@@ -193,7 +584,8 @@ namespace cmd
 		return ext;
 	}
 
-	inline std::string join(const std::vector<std::string>& v, const char* delim)
+	template <class List>
+	std::string join(const List& v, const char* delim)
 	{
 		std::string out;
 		for (size_t i = 0; i < v.size(); ++i)
@@ -205,244 +597,4491 @@ namespace cmd
 		return out;
 	}
 
-	//-----------------------------------------------------------------------------------------
-	// Command-line Argument Parser Class
-	//-----------------------------------------------------------------------------------------
-
-	class CmdArgumentParser
+	// Case-insensitive set of extensions, built once from source_ext or target_ext.
+	// Extensions of up to 8 ASCII characters are packed lowercase into one 64-bit key,
+	// so matching a path is a scan over a few integers read straight from the native
+	// path characters, without creating a lowercase copy of the extension.
+	class ext_set
 	{
 	public:
-		CmdArgumentParser() = default;
-
-		std::filesystem::path source() const { return _source; }
-		std::filesystem::path target() const { return _target; }
-
-		bool parse(int argc, char* argv[])
+		template <class List>
+		explicit ext_set(const List& list)
 		{
-			check();
-
-			std::vector<std::string> flags;
-			std::vector<std::string> files;
-
-			for (int i = 1; i < argc; ++i)
+			// keys has a slot for every extension, so a match gives the list position.
+			for (const std::string_view ext : list)
 			{
-				std::string arg = argv[i] ? argv[i] : "";
-				if (arg.empty()) continue;
-
-				if (arg.front() == '-')
-					flags.emplace_back(arg);
+				uint64_t key = 0;
+				if (pack(ext, key))
+					keys.push_back(key);
 				else
-					files.emplace_back(arg);
+				{
+					keys.push_back(unpacked);
+					other.emplace_back(tolower(ext), keys.size() - 1);
+				}
 			}
+		}
 
-			if (!parseFlags(flags, files.size()))
-				return false;
+		static constexpr size_t npos = static_cast<size_t>(-1);
+
+		bool contains(const std::filesystem::path& file) const { return find(file) != npos; }
+
+		// Position of the file's extension in the list, or npos
+		size_t find(const std::filesystem::path& file) const
+		{
+			uint64_t key = 0;
+			if (pack(extension(file.native()), key))
+			{
+				const auto it = std::find(keys.begin(), keys.end(), key);
+				return it == keys.end() ? npos : static_cast<size_t>(it - keys.begin());
+			}
 
-			if (target_ext.empty())
-				return parseSingleFile(files);
+			// Long or non-ASCII extensions take the slow path.
+			if (other.empty())
+				return npos;
 
-			return parseSourceTargetFiles(files);
+			const auto ext = getExtension(file);
+			const auto it = std::find_if(other.begin(), other.end(), [&](const auto& o) { return o.first == ext; });
+			return it == other.end() ? npos : it->second;
 		}
 
 	private:
+		using native_view = std::basic_string_view<std::filesystem::path::value_type>;
 
-		template <class T, class V>
-		static bool contains(const T& list, const V& value)
+		// Extension without the dot, following the rules of path::extension.
+		static native_view extension(native_view p)
 		{
-			return std::find(list.begin(), list.end(), value) != list.end();
-		}
+			size_t start = 0;
+			for (size_t i = p.size(); i > 0; --i)
+			{
+				if (isSeparator(p[i - 1]))
+				{
+					start = i;
+					break;
+				}
+			}
 
-		static bool err(const std::string& msg)
-		{
-			std::cerr << "Error: " << msg << "\n";
-			return false;
-		}
+			const auto name = p.substr(start);
+			const size_t dot = name.rfind('.');
 
-		static bool err(Msg m, const std::string& s = std::string(), const std::filesystem::path& p = std::filesystem::path())
-		{
-			return err(format(m, s, p));
-		}
+			if (dot == native_view::npos || dot == 0 || (name.size() == 2 && name[0] == '.' && name[1] == '.'))
+				return {};
 
-		static void info(const std::string& msg, int code)
-		{
-			std::cout << msg << "\n";
-			std::exit(code);
+			return name.substr(dot + 1);
 		}
 
-		void check()
+		template <class C>
+		static bool pack(std::basic_string_view<C> ext, uint64_t& key)
 		{
-			cmd::source.clear();
-			cmd::target.clear();
+			if (ext.size() > 8)
+				return false;
 
-			for (auto* f : cmd_flags) f->clear();
+			key = 0;
+			for (const C ch : ext)
+			{
+				auto c = static_cast<std::make_unsigned_t<C>>(ch);
+				if (c == 0 || c >= 0x80)
+					return false;
 
-			if (cmd::source_ext.empty())
-				throw std::runtime_error("Error: source_ext is not defined.");
-			if (!contains(cmd_flags, &help))
-				throw std::runtime_error("Error: cmd_flags must contain 'help' flag.");
-			if (!contains(cmd_flags, &version))
-				throw std::runtime_error("Error: cmd_flags must contain 'version' flag.");
-			if (cmd_flags.size() < 3)
-				throw std::runtime_error("Error: cmd_flags is not defined.");
+				if (c >= 'A' && c <= 'Z')
+					c += 'a' - 'A';
+
+				key = (key << 8) | c;
+			}
+			return true;
 		}
 
-		bool parseFlags(const std::vector<std::string>& flags, const size_t countFiles)
-		{
-			size_t countFlags = 0;
+		// Never a packed key: packed characters are below 0x80.
+		static constexpr uint64_t unpacked = ~uint64_t(0);
 
-			for (const auto& flag : flags)
-			{
-				for (auto* f : cmd_flags)
-				{
-					const std::string s = *f;
+		std::vector<uint64_t> keys;
+		std::vector<std::pair<std::string, size_t>> other;	// lowercase extension, list position
+	};
 
-					if (flag == "-" + s || flag == "--" + s)
-					{
-						*f = true;
-						++countFlags;
-						goto next_flag;
-					}
-				}
+	inline const ext_set& sourceExtensions()
+	{
+		static const ext_set set(source_ext);
+		return set;
+	}
 
-				return err(Msg::UnknownFlag, flag);
+	inline const ext_set& targetExtensions()
+	{
+		static const ext_set set(target_ext);
+		return set;
+	}
 
-			next_flag:
-				;
-			}
+	//-----------------------------------------------------------------------------------------
+	// Extension Dispatch
+	//-----------------------------------------------------------------------------------------
 
-			if (help || version)
-			{
-				if (countFlags > 1 || countFiles != 0)
-					return err(Msg::TooManyArguments);
+	// Converters are picked per (source, target) extension pair. The pairs are numbered
+	// source position * target count + target position, over source_ext and target_ext,
+	// so the parser tags every pair once (cmd_pair::conversion) and the hot loop indexes a
+	// table built at compile time instead of comparing extension strings per file.
+	// Without target extensions (single-file mode) the number is the source position.
+	inline constexpr size_t conversion_count = source_ext.size() * (target_ext.empty() ? 1 : target_ext.size());
 
-				if (help)
-					info(text_help, 0);
+	static_assert(conversion_count < cmd_pair::none, "too many extension pairs for cmd_pair::conversion");
 
-				info(text_version, 0);
-			}
+	constexpr bool equalExt(std::string_view a, std::string_view b)
+	{
+		if (a.size() != b.size())
+			return false;
 
-			return true;
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			const char x = a[i] >= 'A' && a[i] <= 'Z' ? static_cast<char>(a[i] - 'A' + 'a') : a[i];
+			const char y = b[i] >= 'A' && b[i] <= 'Z' ? static_cast<char>(b[i] - 'A' + 'a') : b[i];
+			if (x != y)
+				return false;
 		}
+		return true;
+	}
 
-		bool parseSingleFile(const std::vector<std::string>& files)
+	template <class List>
+	constexpr size_t extPosition(const List& list, std::string_view ext)
+	{
+		for (size_t i = 0; i < list.size(); ++i)
 		{
-			if (files.empty())
-				return err(Msg::NoFileSpecified);
+			if (equalExt(list[i], ext))
+				return i;
+		}
+		return static_cast<size_t>(-1);
+	}
 
-			if (files.size() > 1)
-				return err(Msg::AcceptsOnlyOneFile);
+	// Number of an extension pair given by name (case-insensitive). Evaluated at compile
+	// time, an extension that is not registered does not compile.
+	constexpr uint16_t conversionIndex(std::string_view source, std::string_view target = {})
+	{
+		const size_t s = extPosition(source_ext, source);
+		const size_t t = target_ext.empty() ? 0 : extPosition(target_ext, target);
 
-			_source = files.front();
+		if (s == static_cast<size_t>(-1) || t == static_cast<size_t>(-1))
+			throw std::invalid_argument("extension is not in source_ext or target_ext");
 
-			// Source directory mode: accept existing directory, no target required.
-			if (std::filesystem::is_directory(_source))
-			{
-				if (files.size() > 1)
-					return err(Msg::TooManyArguments);
+		return static_cast<uint16_t>(s * (target_ext.empty() ? 1 : target_ext.size()) + t);
+	}
 
-				cmd::source = _source;
-				return true;
-			}
+	// Number of the extension pair of a source and target path, or cmd_pair::none
+	inline uint16_t conversionOf(const std::filesystem::path& source, const std::filesystem::path& target)
+	{
+		const size_t s = sourceExtensions().find(source);
+		if (s == ext_set::npos)
+			return cmd_pair::none;
 
-			// If source has no parent path, treat it as relative to the current working directory.
-			if (_source.parent_path().empty())
-				_source = std::filesystem::current_path() / _source;
+		if (target_ext.empty())
+			return static_cast<uint16_t>(s);
 
-			if (!std::filesystem::exists(_source))
-				return err(Msg::SourceNotFound, {}, _source);
+		const size_t t = targetExtensions().find(target);
+		if (t == ext_set::npos)
+			return cmd_pair::none;
 
-			if (!contains(source_ext, getExtension(_source)))
-				return err(Msg::SourceInvalidExtension, {}, _source);
+		return static_cast<uint16_t>(s * target_ext.size() + t);
+	}
 
-			cmd::source = _source;
+	using converter = bool (*)(const cmd_pair&);
 
-			return true;
-		}
+	// One registered converter: handler("txt", "csv", txtToCsv)
+	struct cmd_handler
+	{
+		uint16_t conversion;
+		converter fn;
+	};
 
-		bool parseSourceTargetFiles(const std::vector<std::string>& files)
-		{
-			if (files.empty())
-				return err(Msg::NoFilesSpecified);
+	constexpr cmd_handler handler(std::string_view source, std::string_view target, converter fn)
+	{
+		return { conversionIndex(source, target), fn };
+	}
 
-			if (files.size() > 2)
-				return err(Msg::AcceptsOnlySourceAndTargetFiles);
+	// Single-file mode (no target extensions): handler("txt", fn)
+	constexpr cmd_handler handler(std::string_view source, converter fn)
+	{
+		return { conversionIndex(source), fn };
+	}
 
-			_source = files.front();
+	using dispatch_table = std::array<converter, conversion_count>;
 
-			// Source directory mode: accept existing directory, no target required.
-			if (std::filesystem::is_directory(_source))
-			{
-				if (files.size() > 1)
-					return err(Msg::CannotCombineSourceDirectoryAndTargetFile);
+	// Table of converters indexed by cmd_pair::conversion, built at compile time:
+	//   inline constexpr auto converters = cmd::make_dispatch(cmd::handler("txt", "csv", txtToCsv), ...);
+	// Extension pairs without a handler get nullptr.
+	template <class... Handlers>
+	constexpr dispatch_table make_dispatch(Handlers... handlers)
+	{
+		dispatch_table table{};
+		((table[cmd_handler(handlers).conversion] = cmd_handler(handlers).fn), ...);
+		return table;
+	}
 
-				cmd::source = _source;
-				return true;
-			}
+	// Runs the converter registered for the pair; false when there is none.
+	inline bool dispatch(const dispatch_table& table, const cmd_pair& pair)
+	{
+		const converter fn = pair.conversion < table.size() ? table[pair.conversion] : nullptr;
+		return fn && fn(pair);
+	}
 
-			// If source has no parent path, treat it as relative to the current working directory.
-			if (_source.parent_path().empty())
-				_source = std::filesystem::current_path() / _source;
+	// What one stat call tells about a path (symlinks are followed)
+	struct file_info
+	{
+		std::filesystem::file_status status;
+		uintmax_t size = 0;
+		int64_t mtime = 0;	// last write time in native ticks, only meant for comparisons
+	};
 
-			if (!std::filesystem::exists(_source))
-				return err(Msg::SourceNotFound, {}, _source);
+	// Type, size and modification time of a path from a single native call, where
+	// std::filesystem would need status, file_size and last_write_time separately.
+#ifdef _WIN32
+	inline file_info fileInfo(DWORD attributes, DWORD sizeHigh, DWORD sizeLow, const FILETIME& written)
+	{
+		namespace fs = std::filesystem;
 
-			if (!contains(source_ext, getExtension(_source)))
-				return err(Msg::SourceInvalidExtension, {}, _source);
+		file_info info;
+		const bool dir = (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+		info.status = fs::file_status(dir ? fs::file_type::directory : fs::file_type::regular);
+		info.size = (static_cast<uintmax_t>(sizeHigh) << 32) | sizeLow;
+		info.mtime = static_cast<int64_t>((static_cast<uint64_t>(written.dwHighDateTime) << 32) | written.dwLowDateTime);
+		return info;
+	}
+#else
+	inline file_info fileInfo(const struct stat& st)
+	{
+		namespace fs = std::filesystem;
 
-			// Default target is source with default extension.
-			_target = _source;
-			_target.replace_extension(defaultTargetExt());
+		file_info info;
+		fs::file_type type = fs::file_type::unknown;
+		if (S_ISREG(st.st_mode)) type = fs::file_type::regular;
+		else if (S_ISDIR(st.st_mode)) type = fs::file_type::directory;
+		else if (S_ISCHR(st.st_mode)) type = fs::file_type::character;
+		else if (S_ISBLK(st.st_mode)) type = fs::file_type::block;
+		else if (S_ISFIFO(st.st_mode)) type = fs::file_type::fifo;
+		else if (S_ISSOCK(st.st_mode)) type = fs::file_type::socket;
 
-			if (files.size() == 2)
-			{
-				_target = files.back();
+		info.status = fs::file_status(type, static_cast<fs::perms>(st.st_mode & 07777));
+		info.size = static_cast<uintmax_t>(st.st_size);
+#ifdef __APPLE__
+		info.mtime = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+		info.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+		return info;
+	}
+#endif
 
-				// If target has no parent path, treat it as relative to the source directory.
-				if (_target.parent_path().empty())
-					_target = _source.parent_path() / _target;
+	inline file_info statFile(const std::filesystem::path& p)
+	{
+		namespace fs = std::filesystem;
 
-				// If target has a parent path, ensure the parent is a directory.
-				if (!_target.parent_path().empty() && !std::filesystem::is_directory(_target.parent_path()))
-				{
-					if (_target.has_extension())
-						return err(Msg::TargetFileUnknownDirectory, {}, _target);
+		file_info info;
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if (!GetFileAttributesExW(p.c_str(), GetFileExInfoStandard, &data))
+		{
+			const DWORD e = GetLastError();
+			const bool missing = e == ERROR_FILE_NOT_FOUND || e == ERROR_PATH_NOT_FOUND;
+			info.status = fs::file_status(missing ? fs::file_type::not_found : fs::file_type::none);
+			return info;
+		}
 
-					return err(Msg::TargetDirectoryDoesNotExist, {}, _target);
-				}
+		return fileInfo(data.dwFileAttributes, data.nFileSizeHigh, data.nFileSizeLow, data.ftLastWriteTime);
+#else
+		struct stat st {};
+		if (::stat(p.c_str(), &st) != 0)
+		{
+			const bool missing = errno == ENOENT || errno == ENOTDIR;
+			info.status = fs::file_status(missing ? fs::file_type::not_found : fs::file_type::none);
+			return info;
+		}
 
-				// If target has no extension, interpret it as a directory.
-				if (!_target.has_extension())
-				{
-					if (!std::filesystem::is_directory(_target))
-						return err(Msg::TargetDirectoryDoesNotExist, {}, _target);
+		return fileInfo(st);
+#endif
+	}
 
-					_target = _target / _source.filename();
-					_target.replace_extension(defaultTargetExt());
-				}
-			}
+	// Remembers the stat result of every path the parser has looked at, so each distinct
+	// path costs one stat call no matter how many checks (exists, is_directory, ...) use it.
+	class status_cache
+	{
+	public:
+		// With remember set to false a missing entry is looked up without being stored,
+		// which keeps the cache small for paths that are only seen once (stdin streams).
+		const file_info& info(const std::filesystem::path& p, bool remember = true)
+		{
+			auto it = entries.find(p.native());
+			if (it != entries.end())
+				return it->second;
 
-			if (tolower(_source.string()) == tolower(_target.string()))
-				return err(Msg::SourceAndTargetAreSame);
+			++calls;
 
-			if (!contains(target_ext, getExtension(_target)))
-				return err(Msg::TargetInvalidExtension, {}, _target);
+			if (!remember)
+				return scratch = statFile(p);
 
-			cmd::source = _source;
-			cmd::target = _target;
+			return entries.emplace(p.native(), statFile(p)).first->second;
+		}
 
-			return true;
+		std::filesystem::file_status status(const std::filesystem::path& p, bool remember = true)
+		{
+			return info(p, remember).status;
 		}
 
-		std::filesystem::path _source, _target;
-	};
+		bool exists(const std::filesystem::path& p, bool remember = true) { return std::filesystem::exists(status(p, remember)); }
+		bool isDirectory(const std::filesystem::path& p) { return std::filesystem::is_directory(status(p)); }
 
-	//---------------------------------------------------------------------------------------------------------
-	// Command-line Argument Parser for Global Parsing
-	//---------------------------------------------------------------------------------------------------------
+		// Makes a known status available under a second spelling of the same path.
+		void alias(const std::filesystem::path& from, const std::filesystem::path& to)
+		{
+			auto it = entries.find(from.native());
+			if (it != entries.end())
+				entries.emplace(to.native(), it->second);
+		}
+
+		// Queries the paths that are not cached yet on up to threads threads and stores
+		// the results in path order, so the lookups that follow are cache hits. On
+		// high-latency (network) filesystems the round trips then overlap; errors are
+		// still reported by the sequential checks, in argument order.
+		void prefetch(const std::vector<std::filesystem::path>& paths, size_t threads)
+		{
+			std::vector<const std::filesystem::path*> missing;
+			for (const auto& p : paths)
+			{
+				if (entries.find(p.native()) == entries.end())
+					missing.push_back(&p);
+			}
+
+			threads = (std::min)(threads, missing.size());
+			if (threads <= 1)
+				return;
+
+			std::vector<file_info> infos(missing.size());
+			std::atomic<size_t> next{ 0 };
+
+			auto worker = [&]()
+				{
+					for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < missing.size();)
+						infos[i] = statFile(*missing[i]);
+				};
+
+			std::vector<std::thread> pool;
+			pool.reserve(threads);
+
+			for (size_t i = 0; i < threads; ++i)
+				pool.emplace_back(worker);
+
+			for (auto& t : pool)
+				t.join();
+
+			entries.reserve(entries.size() + missing.size());
+			for (size_t i = 0; i < missing.size(); ++i)
+				entries.emplace(missing[i]->native(), infos[i]);
+
+			calls += missing.size();
+		}
+
+		// The cached status of p, or nullptr (safe to call from several threads).
+		const file_info* cached(const std::filesystem::path& p) const
+		{
+			const auto it = entries.find(p.native());
+			return it == entries.end() ? nullptr : &it->second;
+		}
+
+		// Stores a status learned another way (from an open handle); counts as a call.
+		void store(const std::filesystem::path& p, const file_info& info)
+		{
+			entries[p.native()] = info;
+			++calls;
+		}
+
+		// Number of status calls that actually reached the filesystem
+		size_t statCalls() const { return calls; }
+
+		void clear()
+		{
+			entries.clear();
+			calls = 0;
+		}
+
+	private:
+		std::unordered_map<std::filesystem::path::string_type, file_info> entries;
+		file_info scratch;
+		size_t calls = 0;
+	};
+
+	// Open-addressing hash table over registered flags or options, keyed by name.
+	// Matching an argument costs one hash and (normally) one compare, without allocating.
+	// find returns the position in the registry, so per-parse values can be kept by index.
+	template <class T>
+	class name_table
+	{
+	public:
+		static constexpr size_t npos = static_cast<size_t>(-1);
+
+		template <class List>
+		explicit name_table(const List& registry) : list(registry.data())
+		{
+			size_t size = 8;
+			while (size < registry.size() * 2)
+				size *= 2;
+
+			mask = size - 1;
+			slots.assign(size, npos);
+
+			for (size_t n = 0; n < registry.size(); ++n)
+			{
+				size_t i = hash(list[n]->name()) & mask;
+				while (slots[i] != npos)
+					i = (i + 1) & mask;
+				slots[i] = n;
+			}
+		}
+
+		size_t find(std::string_view name) const
+		{
+			for (size_t i = hash(name) & mask; slots[i] != npos; i = (i + 1) & mask)
+			{
+				if (list[slots[i]]->name() == name)
+					return slots[i];
+			}
+			return npos;
+		}
+
+	private:
+		// FNV-1a
+		static size_t hash(std::string_view s)
+		{
+			uint64_t h = 14695981039346656037ull;
+			for (unsigned char c : s)
+				h = (h ^ c) * 1099511628211ull;
+			return static_cast<size_t>(h);
+		}
+
+		T* const* list;
+		std::vector<size_t> slots;
+		size_t mask = 0;
+	};
+
+	// The registries do not change after static initialization, so the tables are built once.
+	inline const name_table<cmd_flag>& flagTable()
+	{
+		static const name_table<cmd_flag> table(cmd_flags);
+		return table;
+	}
+
+	inline const name_table<cmd_option>& optionTable()
+	{
+		static const name_table<cmd_option> table(cmd_options);
+		return table;
+	}
+
+	//-----------------------------------------------------------------------------------------
+	// Compact Work List
+	//-----------------------------------------------------------------------------------------
+
+	// Expanded directory sources stored for work lists of millions of files: each directory
+	// is kept once, the file names share one buffer and an entry is 16 bytes. Paths are
+	// built only when asked for, so the worker that runs a pair creates it and the list
+	// holds no path per file. The target of an entry is derived from its name, the target
+	// directory of its source directory and defaultTargetExt().
+	class cmd_worklist
+	{
+	public:
+		using string_view_type = std::basic_string_view<std::filesystem::path::value_type>;
+
+		size_t size() const { return entries.size(); }
+		bool empty() const { return entries.empty(); }
+
+		// Adds a file, with its directory interned. Files of one directory usually come
+		// together, so the lookup is a compare with the previous directory.
+		void add(const std::filesystem::path& file)
+		{
+			const auto& p = file.native();
+
+			size_t split = p.size();
+			while (split > 0 && !isSeparator(p[split - 1]))
+				--split;
+
+			const string_view_type prefix(p.data(), split);
+
+			if (dirs.empty() || prefix != last)
+			{
+				last.assign(prefix);
+				current = intern(file.parent_path());
+			}
+
+			entries.push_back({ names.size(), static_cast<uint32_t>(p.size() - split), current });
+			names.append(p, split, std::filesystem::path::string_type::npos);
+		}
+
+		std::filesystem::path source(size_t i) const
+		{
+			const auto& e = entries[i];
+			return dirs[e.dir] / name(i);
+		}
+
+		// Target of entry i; empty when its directory has no target directory.
+		std::filesystem::path target(size_t i) const
+		{
+			const auto& dir = targets[entries[i].dir];
+			if (dir.empty())
+				return {};
+
+			auto target = dir / name(i);
+			target.replace_extension(defaultTargetExt());
+			return target;
+		}
+
+		cmd_pair pair(size_t i) const
+		{
+			cmd_pair pair{ source(i), target(i) };
+			pair.conversion = conversionOf(pair.source, pair.target);
+			return pair;
+		}
+
+		string_view_type name(size_t i) const
+		{
+			const auto& e = entries[i];
+			return string_view_type(names).substr(e.offset, e.length);
+		}
+
+		// Name without its extension; with the directory it identifies the target.
+		string_view_type stem(size_t i) const
+		{
+			const auto n = name(i);
+			const size_t dot = n.rfind('.');
+			return dot == string_view_type::npos || dot == 0 ? n : n.substr(0, dot);
+		}
+
+		size_t directoryOf(size_t i) const { return entries[i].dir; }
+
+		size_t directories() const { return dirs.size(); }
+		const std::filesystem::path& directory(size_t d) const { return dirs[d]; }
+
+		// The target directory of the files of source directory d
+		void targetDirectory(size_t d, std::filesystem::path dir) { targets[d] = std::move(dir); }
+		const std::filesystem::path& targetDirectory(size_t d) const { return targets[d]; }
+
+		// Keeps the entries i for which keep(i) is true, in order.
+		template <class F>
+		void keep(F keep)
+		{
+			size_t n = 0;
+			for (size_t i = 0; i < entries.size(); ++i)
+			{
+				if (keep(i))
+					entries[n++] = entries[i];
+			}
+			entries.resize(n);
+		}
+
+		// Orders the entries by directory, then by name.
+		void sort()
+		{
+			std::sort(entries.begin(), entries.end(), [&](const entry& a, const entry& b)
+				{
+					if (a.dir != b.dir)
+						return dirs[a.dir].native() < dirs[b.dir].native();
+
+					const string_view_type n(names);
+					return n.substr(a.offset, a.length) < n.substr(b.offset, b.length);
+				});
+		}
+
+		// Puts the entries in the given order (a permutation of the entry positions).
+		void reorder(const std::vector<size_t>& order)
+		{
+			std::vector<entry> sorted;
+			sorted.reserve(order.size());
+
+			for (size_t i : order)
+				sorted.push_back(entries[i]);
+
+			entries = std::move(sorted);
+		}
+
+	private:
+		struct entry
+		{
+			size_t offset;		// of the file name in names
+			uint32_t length;
+			uint32_t dir;
+		};
+
+
+		uint32_t intern(std::filesystem::path dir)
+		{
+			const auto it = index.find(dir.native());
+			if (it != index.end())
+				return it->second;
+
+			const auto d = static_cast<uint32_t>(dirs.size());
+			index.emplace(dir.native(), d);
+			dirs.push_back(std::move(dir));
+			targets.emplace_back();
+			return d;
+		}
+
+		std::vector<entry> entries;
+		std::filesystem::path::string_type names;
+		std::vector<std::filesystem::path> dirs;
+		std::vector<std::filesystem::path> targets;	// per directory, empty for none
+		std::unordered_map<std::filesystem::path::string_type, uint32_t> index;
+		std::filesystem::path::string_type last;	// prefix of the previous file, with its separator
+		uint32_t current = 0;
+	};
+
+	//-----------------------------------------------------------------------------------------
+	// Worker Pool
+	//-----------------------------------------------------------------------------------------
+
+	// Called once per (source, target) pair; return false to report a failed conversion.
+	using pair_callback = std::function<bool(const cmd_pair&)>;
+
+	// Number of worker threads for the given amount of work (-jobs, or all cores when it is 0).
+	inline size_t workerCount(size_t work, long long jobs)
+	{
+		const size_t n = jobs > 0 ? static_cast<size_t>(jobs) : std::thread::hardware_concurrency();
+		return (std::max<size_t>)(1, (std::min)(n, work));
+	}
+
+	// Lets a caller stop a running pool: pairs not started yet are skipped once cancel()
+	// is called (from any thread, including a callback itself).
+	class cmd_cancel
+	{
+	public:
+		void cancel() { flag.store(true, std::memory_order_relaxed); }
+		bool cancelled() const { return flag.load(std::memory_order_relaxed); }
+	private:
+		std::atomic<bool> flag{ false };
+	};
+
+	// Work-stealing split of n items over a fixed number of workers. Worker w owns the
+	// stripe w, w + workers, w + 2 * workers, ... (so the largest files of a list sorted by
+	// size start on different workers) and takes its own items in order. A worker that
+	// runs dry steals the back half of the fullest remaining range. The ranges have a lock
+	// each, which only ever sees contention while a steal is going on.
+	class steal_ranges
+	{
+	public:
+		steal_ranges(size_t items, size_t workers) : items(items), workers(workers), ranges(workers)
+		{
+			for (size_t w = 0; w < workers; ++w)
+			{
+				ranges[w].stripe = w;
+				ranges[w].end = w < items ? (items - w + workers - 1) / workers : 0;
+			}
+		}
+
+		// Next item for worker self; false when no work is left anywhere.
+		bool take(size_t self, size_t& item)
+		{
+			auto& own = ranges[self];
+			{
+				std::lock_guard<std::mutex> lock(own.mutex);
+				if (own.begin < own.end)
+				{
+					item = own.begin++ * workers + own.stripe;
+					return true;
+				}
+			}
+
+			for (;;)
+			{
+				size_t victim = self, most = 0;
+				for (size_t w = 0; w < workers; ++w)
+				{
+					if (w == self)
+						continue;
+
+					std::lock_guard<std::mutex> lock(ranges[w].mutex);
+					if (ranges[w].end - ranges[w].begin > most)
+					{
+						most = ranges[w].end - ranges[w].begin;
+						victim = w;
+					}
+				}
+
+				if (most == 0)
+					return false;
+
+				size_t stripe, begin, end;
+				{
+					auto& r = ranges[victim];
+					std::lock_guard<std::mutex> lock(r.mutex);
+
+					const size_t left = r.end - r.begin;
+					if (left == 0)
+						continue;
+
+					stripe = r.stripe;
+					end = r.end;
+					begin = r.end -= (left + 1) / 2;
+				}
+
+				// The first stolen item is run now, the rest becomes this worker's range.
+				item = begin * workers + stripe;
+
+				std::lock_guard<std::mutex> lock(own.mutex);
+				own.stripe = stripe;
+				own.begin = begin + 1;
+				own.end = end;
+				return true;
+			}
+		}
+
+	private:
+		struct alignas(64) range
+		{
+			std::mutex mutex;
+			size_t stripe = 0;
+			size_t begin = 0;	// slots of the stripe: item = slot * workers + stripe
+			size_t end = 0;
+		};
+
+		const size_t items;
+		const size_t workers;
+		std::vector<range> ranges;
+	};
+
+	inline void willNeed(const cmd_pair& pair);
+
+	// Runs fn over the n pairs that at(i) hands out (a reference or a pair built on the
+	// spot) on a pool of worker threads that share the work through steal_ranges, so
+	// 1 KB and 20 GB files balance out and idle workers take over the backlog of busy
+	// ones. Returns true when every call succeeded and nothing was cancelled. If fn
+	// throws, the remaining pairs are skipped and the first exception is rethrown once
+	// all workers have stopped.
+	// With ahead above 0, a worker that starts pair i asks the system to read source
+	// i + ahead into the cache, so I/O on cold disks overlaps with the conversions.
+	template <class At>
+	bool runPairs(size_t n, At at, const pair_callback& fn, long long jobs, const cmd_cancel* cancel, long long ahead)
+	{
+		std::atomic<bool> ok{ true };
+		std::atomic<bool> stop{ false };
+		std::atomic_flag failed = ATOMIC_FLAG_INIT;
+		std::exception_ptr error;
+
+		const size_t count = workerCount(n, jobs);
+		steal_ranges work(n, count);
+
+		const size_t k = ahead > 0 ? static_cast<size_t>(ahead) : 0;
+
+		auto worker = [&](size_t self)
+			{
+				// The first k sources are shared out over the workers up front.
+				for (size_t j = self; j < k && j < n; j += count)
+					willNeed(at(j));
+
+				for (size_t i; !stop && work.take(self, i);)
+				{
+					if (cancel && cancel->cancelled())
+					{
+						ok = false;
+						stop = true;
+						break;
+					}
+
+					if (k && i + k < n)
+						willNeed(at(i + k));
+
+					try
+					{
+						if (!fn(at(i)))
+							ok = false;
+					}
+					catch (...)
+					{
+						if (!failed.test_and_set())
+							error = std::current_exception();
+
+						ok = false;
+						stop = true;
+					}
+				}
+			};
+
+		std::vector<std::thread> threads;
+		threads.reserve(count - 1);
+
+		for (size_t i = 1; i < count; ++i)
+			threads.emplace_back(worker, i);
+
+		worker(0);
+
+		for (auto& t : threads)
+			t.join();
+
+		if (error)
+			std::rethrow_exception(error);
+
+		return ok;
+	}
+
+	// Runs fn over all pairs (see runPairs).
+	inline bool run(const std::vector<cmd_pair>& list, const pair_callback& fn, long long jobs = cmd::jobs,
+		const cmd_cancel* cancel = nullptr, long long ahead = cmd::readahead)
+	{
+		return runPairs(list.size(), [&](size_t i) -> const cmd_pair& { return list[i]; }, fn, jobs, cancel, ahead);
+	}
+
+	// Runs fn over a compact work list; each worker builds the pairs it runs.
+	inline bool run(const cmd_worklist& list, const pair_callback& fn, long long jobs = cmd::jobs,
+		const cmd_cancel* cancel = nullptr, long long ahead = cmd::readahead)
+	{
+		return runPairs(list.size(), [&](size_t i) { return list.pair(i); }, fn, jobs, cancel, ahead);
+	}
+
+	// Calls fn(i) for every i below n on up to threads threads (on the calling thread alone
+	// when threads is 1). fn must not throw.
+	template <class F>
+	void forEachIndex(size_t n, size_t threads, F fn)
+	{
+		std::atomic<size_t> next{ 0 };
+
+		auto worker = [&]()
+			{
+				for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < n;)
+					fn(i);
+			};
+
+		std::vector<std::thread> pool;
+		for (size_t i = 1; i < threads; ++i)
+			pool.emplace_back(worker);
+
+		worker();
+
+		for (auto& t : pool)
+			t.join();
+	}
+
+	// Bounded queue of pairs between one producer and the workers. push blocks while the
+	// queue is full, so the producer never runs more than capacity pairs ahead.
+	class pair_queue
+	{
+	public:
+		explicit pair_queue(size_t capacity) : capacity(capacity) {}
+
+		void push(cmd_pair pair)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			notFull.wait(lock, [&] { return items.size() < capacity || closed; });
+
+			if (closed)
+				return;
+
+			items.push_back(std::move(pair));
+			notEmpty.notify_one();
+		}
+
+		// Waits for the next pair; false once the queue is closed and drained.
+		bool pop(cmd_pair& pair)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			notEmpty.wait(lock, [&] { return !items.empty() || closed; });
+
+			if (items.empty())
+				return false;
+
+			pair = std::move(items.front());
+			items.pop_front();
+			notFull.notify_one();
+			return true;
+		}
+
+		// No more pairs will be pushed; the workers finish what is queued.
+		void close()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+			notEmpty.notify_all();
+			notFull.notify_all();
+		}
+
+		// Like close, but the queued pairs are dropped as well.
+		void cancel()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			items.clear();
+			closed = true;
+			notEmpty.notify_all();
+			notFull.notify_all();
+		}
+
+	private:
+		const size_t capacity;
+		std::deque<cmd_pair> items;
+		std::mutex mutex;
+		std::condition_variable notEmpty, notFull;
+		bool closed = false;
+	};
+
+	// Reads one line without the line break; false at the end of the input.
+	// fgets returns as soon as a line is available, so pipes are consumed as they fill.
+	inline bool readLine(std::FILE* in, std::string& line)
+	{
+		line.clear();
+
+		char buffer[4096];
+		while (std::fgets(buffer, sizeof(buffer), in))
+		{
+			line += buffer;
+
+			if (line.back() == '\n')
+			{
+				line.pop_back();
+				if (!line.empty() && line.back() == '\r')
+					line.pop_back();
+				return true;
+			}
+		}
+
+		return !line.empty();
+	}
+
+	//-----------------------------------------------------------------------------------------
+	// Memory-mapped Files
+	//-----------------------------------------------------------------------------------------
+
+	// Read-only view of a whole file, mapped into memory (empty files give an empty view).
+	class mapped_file
+	{
+	public:
+		mapped_file() = default;
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		mapped_file(mapped_file&& other) noexcept
+			: _data(other._data), _size(other._size)
+		{
+			other._data = nullptr;
+			other._size = 0;
+		}
+
+		mapped_file& operator=(mapped_file&& other) noexcept
+		{
+			if (this != &other)
+			{
+				close();
+				std::swap(_data, other._data);
+				std::swap(_size, other._size);
+			}
+			return *this;
+		}
+
+		~mapped_file() { close(); }
+
+#ifdef _WIN32
+		using native_handle = HANDLE;
+#else
+		using native_handle = int;
+#endif
+
+		bool open(const std::filesystem::path& file)
+		{
+			close();
+#ifdef _WIN32
+			HANDLE h = CreateFileW(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+				OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (h == INVALID_HANDLE_VALUE)
+				return false;
+
+			LARGE_INTEGER size{};
+			const bool ok = GetFileSizeEx(h, &size) != 0 && map(h, static_cast<uint64_t>(size.QuadPart));
+
+			CloseHandle(h);
+#else
+			const int fd = ::open(file.c_str(), O_RDONLY);
+			if (fd < 0)
+				return false;
+
+			struct stat st {};
+			const bool ok = ::fstat(fd, &st) == 0 && map(fd, static_cast<uint64_t>(st.st_size));
+
+			::close(fd);
+#endif
+			return ok;
+		}
+
+		// Maps size bytes of a file opened for reading; the handle stays with the caller
+		// and may be closed once this returns. An empty file maps to an empty view.
+		bool map(native_handle h, uint64_t size)
+		{
+			close();
+
+			if (size == 0)
+				return true;
+
+			if (size > (std::numeric_limits<size_t>::max)())
+				return false;
+#ifdef _WIN32
+			HANDLE m = CreateFileMappingW(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (!m)
+				return false;
+
+			_data = static_cast<const char*>(MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0));
+			CloseHandle(m);
+
+			if (!_data)
+				return false;
+#else
+			void* p = ::mmap(nullptr, static_cast<size_t>(size), PROT_READ, MAP_PRIVATE, h, 0);
+			if (p == MAP_FAILED)
+				return false;
+
+			::madvise(p, static_cast<size_t>(size), MADV_SEQUENTIAL);
+			_data = static_cast<const char*>(p);
+#endif
+			_size = static_cast<size_t>(size);
+			return true;
+		}
+
+		void close()
+		{
+			if (_data)
+			{
+#ifdef _WIN32
+				UnmapViewOfFile(_data);
+#else
+				::munmap(const_cast<char*>(_data), _size);
+#endif
+			}
+			_data = nullptr;
+			_size = 0;
+		}
+
+		std::string_view view() const { return { _data, _size }; }
+
+	private:
+		const char* _data = nullptr;
+		size_t _size = 0;
+	};
+
+	// A source file the parser opened once for the converter (see CmdArgumentParser::openSources),
+	// so the data is read from the very file that was validated, without a second open.
+	// Holds the native handle or, when requested, a read-only mapping of the whole file
+	// (the handle is closed once the file is mapped, so mapped sources hold no descriptor).
+	class source_file
+	{
+	public:
+		using native_handle = mapped_file::native_handle;
+
+		source_file() = default;
+		source_file(const source_file&) = delete;
+		source_file& operator=(const source_file&) = delete;
+
+		~source_file() { close(); }
+
+		// On failure error() tells why (no such file, permission, too many open files).
+		bool open(const std::filesystem::path& file, bool map)
+		{
+			close();
+			_error.clear();
+#ifdef _WIN32
+			_handle = CreateFileW(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+				OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (_handle == INVALID_HANDLE_VALUE)
+				return fail(std::error_code(static_cast<int>(GetLastError()), std::system_category()));
+
+			BY_HANDLE_FILE_INFORMATION data;
+			if (!GetFileInformationByHandle(_handle, &data))
+				return fail(std::error_code(static_cast<int>(GetLastError()), std::system_category()));
+
+			_info = fileInfo(data.dwFileAttributes, data.nFileSizeHigh, data.nFileSizeLow, data.ftLastWriteTime);
+#else
+			_handle = ::open(file.c_str(), O_RDONLY);
+			if (_handle < 0)
+				return fail(std::error_code(errno, std::generic_category()));
+
+			struct stat st {};
+			if (::fstat(_handle, &st) != 0)
+				return fail(std::error_code(errno, std::generic_category()));
+
+			_info = fileInfo(st);
+#endif
+			// Anything but a regular file counts as not found, as for a stat'ed source.
+			if (!std::filesystem::is_regular_file(_info.status))
+				return fail(std::make_error_code(std::errc::no_such_file_or_directory));
+
+			if (map)
+			{
+				if (!_map.map(_handle, _info.size))
+					return fail(std::make_error_code(std::errc::not_enough_memory));
+
+				closeHandle();
+			}
+
+			return true;
+		}
+
+		void close()
+		{
+			_map.close();
+			closeHandle();
+		}
+
+		// Why the last open() failed
+		const std::error_code& error() const { return _error; }
+
+		// Reads up to size bytes at offset, without moving a shared file position (safe
+		// across threads). Returns the number of bytes read, 0 at the end or on error.
+		size_t read(void* buffer, size_t size, uint64_t offset) const
+		{
+			if (mapped())
+			{
+				const auto data = _map.view();
+				if (offset >= data.size())
+					return 0;
+
+				const size_t n = (std::min<size_t>)(size, data.size() - static_cast<size_t>(offset));
+				std::memcpy(buffer, data.data() + offset, n);
+				return n;
+			}
+#ifdef _WIN32
+			OVERLAPPED at{};
+			at.Offset = static_cast<DWORD>(offset);
+			at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+			DWORD done = 0;
+			const DWORD chunk = static_cast<DWORD>((std::min<size_t>)(size, 1u << 30));
+			return ReadFile(_handle, buffer, chunk, &done, &at) ? done : 0;
+#else
+			const ssize_t done = ::pread(_handle, buffer, size, static_cast<off_t>(offset));
+			return done > 0 ? static_cast<size_t>(done) : 0;
+#endif
+		}
+
+		// The open handle; invalid (-1 or INVALID_HANDLE_VALUE) once the file is mapped
+		native_handle handle() const { return _handle; }
+
+		// Type, size and modification time of the open file
+		const file_info& info() const { return _info; }
+		uintmax_t size() const { return _info.size; }
+
+		// The whole file when it was opened with map, else empty
+		std::string_view view() const { return _map.view(); }
+
+		// True when the file was opened with map (and holds no handle)
+		bool mapped() const
+		{
+#ifdef _WIN32
+			return _handle == INVALID_HANDLE_VALUE;
+#else
+			return _handle < 0;
+#endif
+		}
+
+	private:
+		bool fail(std::error_code error)
+		{
+			_error = error;
+			close();
+			return false;
+		}
+
+		void closeHandle()
+		{
+#ifdef _WIN32
+			if (_handle != INVALID_HANDLE_VALUE)
+				CloseHandle(_handle);
+			_handle = INVALID_HANDLE_VALUE;
+#else
+			if (_handle >= 0)
+				::close(_handle);
+			_handle = -1;
+#endif
+		}
+
+#ifdef _WIN32
+		HANDLE _handle = INVALID_HANDLE_VALUE;
+#else
+		int _handle = -1;
+#endif
+		file_info _info;
+		mapped_file _map;
+		std::error_code _error;
+	};
+
+	// Asks the system to start reading a source into the page cache and returns at once:
+	// posix_fadvise(WILLNEED) on Linux, F_RDADVISE on macOS, madvise(WILLNEED) for a mapped
+	// source on POSIX, and PrefetchVirtualMemory for a mapped source on Windows (unmapped
+	// sources get no hint there). Failures are ignored.
+	inline void willNeed(const cmd_pair& pair)
+	{
+#ifdef _WIN32
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0602
+		if (pair.file && !pair.file->view().empty())
+		{
+			WIN32_MEMORY_RANGE_ENTRY range{ const_cast<char*>(pair.file->view().data()), pair.file->view().size() };
+			PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+		}
+#else
+		(void)pair;
+#endif
+#else
+		// A mapped source has no descriptor left; the hint goes to its pages instead.
+		if (pair.file && pair.file->mapped())
+		{
+			const auto data = pair.file->view();
+			if (!data.empty())
+				::madvise(const_cast<char*>(data.data()), data.size(), MADV_WILLNEED);
+			return;
+		}
+
+		const int fd = pair.file ? pair.file->handle() : ::open(pair.source.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+#if defined(POSIX_FADV_WILLNEED)
+		::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+		struct stat st {};
+		if (::fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			radvisory advice{ 0, static_cast<int>((std::min<off_t>)(st.st_size, INT32_MAX)) };
+			::fcntl(fd, F_RDADVISE, &advice);
+		}
+#endif
+		if (!pair.file)
+			::close(fd);
+#endif
+	}
+
+	// Appends the non-empty lines of text (LF or CRLF) to out, as views into text.
+	inline void splitLines(std::string_view text, std::vector<std::string_view>& out)
+	{
+		const char* p = text.data();
+		const char* end = p + text.size();
+
+		// Skip a UTF-8 byte order mark written by some editors.
+		if (text.size() >= 3 && std::memcmp(p, "\xEF\xBB\xBF", 3) == 0)
+			p += 3;
+
+		while (p < end)
+		{
+			const char* nl = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+			const char* stop = nl ? nl : end;
+			const char* last = stop;
+
+			if (last > p && last[-1] == '\r')
+				--last;
+
+			if (last > p)
+				out.emplace_back(p, static_cast<size_t>(last - p));
+
+			p = stop + 1;
+		}
+	}
+
+	//-----------------------------------------------------------------------------------------
+	// Target Writer
+	//-----------------------------------------------------------------------------------------
+
+	// Writes a target so that it appears complete or not at all: the data goes to a
+	// temporary file next to the target (same directory, so the same filesystem), through
+	// a large buffer, and commit() renames it over the target. A writer destroyed without
+	// commit() removes the temporary file, so a crash or error never leaves a half-written
+	// target behind (and -incremental never mistakes one for up to date).
+	// With an expected size, the space is reserved up front, which keeps the target in one
+	// piece on disk while many workers write at the same time.
+	class target_writer
+	{
+	public:
+		static constexpr size_t default_buffer = 1 << 20;
+
+		target_writer() = default;
+		target_writer(const target_writer&) = delete;
+		target_writer& operator=(const target_writer&) = delete;
+
+		~target_writer() { discard(); }
+
+		bool open(const cmd_pair& pair, uint64_t expected = 0, size_t buffer = default_buffer)
+		{
+			return open(pair.target, expected, buffer);
+		}
+
+		bool open(const std::filesystem::path& target, uint64_t expected = 0, size_t buffer = default_buffer)
+		{
+			discard();
+
+			_target = target;
+			_temp = temporaryName(target);
+			_buffer.resize((std::max<size_t>)(buffer, 4096));
+			_used = 0;
+			_written = 0;
+			_reserved = false;
+#ifdef _WIN32
+			_handle = CreateFileW(_temp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (_handle == INVALID_HANDLE_VALUE)
+				return false;
+
+			if (expected > 0)
+			{
+				FILE_ALLOCATION_INFO allocation{};
+				allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(expected);
+				_reserved = SetFileInformationByHandle(_handle, FileAllocationInfo, &allocation, sizeof(allocation)) != 0;
+			}
+#else
+			_handle = ::open(_temp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+			if (_handle < 0)
+				return false;
+
+#if defined(__linux__)
+			if (expected > 0)
+				_reserved = ::posix_fallocate(_handle, 0, static_cast<off_t>(expected)) == 0;
+#elif defined(F_PREALLOCATE)
+			if (expected > 0)
+			{
+				fstore_t store{ F_ALLOCATEALL, F_PEOFPOSMODE, 0, static_cast<off_t>(expected), 0 };
+				_reserved = ::fcntl(_handle, F_PREALLOCATE, &store) != -1;
+			}
+#endif
+#endif
+			return true;
+		}
+
+		bool write(const void* data, size_t size)
+		{
+			if (!isOpen())
+				return false;
+
+			const char* p = static_cast<const char*>(data);
+
+			// Large blocks bypass the buffer once it is drained.
+			if (size >= _buffer.size())
+				return flush() && writeAll(p, size);
+
+			if (_used + size > _buffer.size() && !flush())
+				return false;
+
+			std::memcpy(_buffer.data() + _used, p, size);
+			_used += size;
+			return true;
+		}
+
+		bool write(std::string_view text) { return write(text.data(), text.size()); }
+
+		// With durable (the default) commit() puts the data on disk before the rename and the
+		// rename into the directory after it, so a committed target, and a -resume journal
+		// record made after the commit, survive a power loss. Off, the system writes both
+		// back when it likes: faster, but a crash may leave a target empty or missing.
+		void durable(bool sync) { _durable = sync; }
+
+		// Moves the complete file into place over the target. After a failed commit the
+		// target is unchanged and the temporary file is gone.
+		bool commit()
+		{
+			if (!isOpen())
+				return false;
+
+			bool ok = flush();
+#ifdef _WIN32
+			if (ok && _durable)
+				ok = FlushFileBuffers(_handle) != 0;
+
+			ok = CloseHandle(_handle) != 0 && ok;
+			_handle = INVALID_HANDLE_VALUE;
+
+			const DWORD flags = MOVEFILE_REPLACE_EXISTING | (_durable ? MOVEFILE_WRITE_THROUGH : 0);
+			ok = ok && MoveFileExW(_temp.c_str(), _target.c_str(), flags) != 0;
+#else
+			// Space reserved beyond what was written is given back.
+			if (ok && _reserved)
+				ok = ::ftruncate(_handle, static_cast<off_t>(_written)) == 0;
+
+			if (ok && _durable)
+				ok = syncFile(_handle);
+
+			ok = ::close(_handle) == 0 && ok;
+			_handle = -1;
+
+			ok = ok && ::rename(_temp.c_str(), _target.c_str()) == 0;
+
+			if (ok && _durable)
+				syncDirectory(_target.parent_path());
+#endif
+			if (!ok)
+				removeTemporary();
+
+			_temp.clear();
+			return ok;
+		}
+
+		// Drops everything written so far; the target is left as it was.
+		void discard()
+		{
+			if (!isOpen())
+				return;
+#ifdef _WIN32
+			CloseHandle(_handle);
+			_handle = INVALID_HANDLE_VALUE;
+#else
+			::close(_handle);
+			_handle = -1;
+#endif
+			removeTemporary();
+			_temp.clear();
+		}
+
+		bool isOpen() const
+		{
+#ifdef _WIN32
+			return _handle != INVALID_HANDLE_VALUE;
+#else
+			return _handle >= 0;
+#endif
+		}
+
+		// Bytes written so far (buffered bytes included)
+		uint64_t size() const { return _written + _used; }
+
+	private:
+		bool flush()
+		{
+			const bool ok = writeAll(_buffer.data(), _used);
+			_used = 0;
+			return ok;
+		}
+
+		bool writeAll(const char* p, size_t size)
+		{
+			while (size > 0)
+			{
+#ifdef _WIN32
+				DWORD done = 0;
+				const DWORD chunk = static_cast<DWORD>((std::min<size_t>)(size, 1u << 30));
+				if (!WriteFile(_handle, p, chunk, &done, nullptr) || done == 0)
+					return false;
+#else
+				const ssize_t done = ::write(_handle, p, size);
+				if (done < 0 && errno == EINTR)
+					continue;
+				if (done <= 0)
+					return false;
+#endif
+				p += done;
+				size -= static_cast<size_t>(done);
+				_written += static_cast<uint64_t>(done);
+			}
+			return true;
+		}
+
+		void removeTemporary()
+		{
+			std::error_code ec;
+			std::filesystem::remove(_temp, ec);
+		}
+
+#ifndef _WIN32
+		static bool syncFile(int fd)
+		{
+#if defined(__APPLE__)
+			return ::fsync(fd) == 0;
+#else
+			return ::fdatasync(fd) == 0;
+#endif
+		}
+
+		// Makes the rename itself durable. The target is in place by now, so a failure is
+		// ignored (some file systems cannot sync a directory).
+		static void syncDirectory(const std::filesystem::path& dir)
+		{
+			const int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (fd < 0)
+				return;
+
+			::fsync(fd);
+			::close(fd);
+		}
+#endif
+
+		// .<name>.<process>.<n>.tmp in the target directory, unique across the workers
+		static std::filesystem::path temporaryName(const std::filesystem::path& target)
+		{
+			static std::atomic<uint64_t> counter{ 0 };
+#ifdef _WIN32
+			const unsigned long process = GetCurrentProcessId();
+#else
+			const unsigned long process = static_cast<unsigned long>(::getpid());
+#endif
+			auto name = target.filename().string();
+			name.insert(0, ".");
+			name += "." + std::to_string(process) + "." + std::to_string(counter++) + ".tmp";
+			return target.parent_path() / name;
+		}
+
+		std::filesystem::path _target;
+		std::filesystem::path _temp;
+		std::vector<char> _buffer;
+		size_t _used = 0;
+		uint64_t _written = 0;
+		bool _reserved = false;
+		bool _durable = true;
+#ifdef _WIN32
+		HANDLE _handle = INVALID_HANDLE_VALUE;
+#else
+		int _handle = -1;
+#endif
+	};
+
+	//-----------------------------------------------------------------------------------------
+	// Change Notifications
+	//-----------------------------------------------------------------------------------------
+
+	// Reports the files created, modified or moved into a directory (and its subdirectories
+	// when recursive): inotify on Linux, ReadDirectoryChangesW on Windows, and on other
+	// systems a rescan of the tree (every rescan() interval) compared with the previous one. A burst of events (a
+	// file written in several blocks, a copied tree) comes back from wait() as one batch.
+	// When the system drops events (queue overflow) the whole tree is reported.
+	class directory_watch
+	{
+	public:
+		directory_watch() = default;
+		directory_watch(const directory_watch&) = delete;
+		directory_watch& operator=(const directory_watch&) = delete;
+
+		~directory_watch() { close(); }
+
+		bool open(const std::filesystem::path& dir, bool recursive)
+		{
+			close();
+
+			_dir = dir;
+			_recursive = recursive;
+#if defined(_WIN32)
+			_handle = CreateFileW(dir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+				nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+			if (_handle == INVALID_HANDLE_VALUE)
+				return false;
+
+			_event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+			_buffer.resize(64 * 1024 / sizeof(DWORD));	// the limit for network shares
+
+			if (!_event || !request())
+			{
+				close();
+				return false;
+			}
+			return true;
+#elif defined(__linux__)
+			_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (_fd < 0 || !addTree(dir, nullptr))
+			{
+				close();
+				return false;
+			}
+			return true;
+#else
+			return scan(nullptr);
+#endif
+		}
+
+		void close()
+		{
+#if defined(_WIN32)
+			if (_handle != INVALID_HANDLE_VALUE)
+			{
+				DWORD bytes = 0;
+				if (_pending && CancelIoEx(_handle, &_overlapped))
+					GetOverlappedResult(_handle, &_overlapped, &bytes, TRUE);
+
+				CloseHandle(_handle);
+				_handle = INVALID_HANDLE_VALUE;
+			}
+
+			if (_event)
+			{
+				CloseHandle(_event);
+				_event = nullptr;
+			}
+			_pending = false;
+#elif defined(__linux__)
+			if (_fd >= 0)
+			{
+				::close(_fd);
+				_fd = -1;
+			}
+			_dirs.clear();
+#else
+			_snapshot.clear();
+#endif
+		}
+
+		// Waits up to timeout for changes and adds the changed files to changed, sorted
+		// and each once. Returns false when the watch broke down.
+		bool wait(std::vector<std::filesystem::path>& changed, std::chrono::milliseconds timeout)
+		{
+			const size_t first = changed.size();
+
+			bool ok = collect(changed, timeout);
+
+#if defined(_WIN32) || defined(__linux__)
+			// Goes on collecting until the directory has been quiet for a moment.
+			for (size_t n = first; ok && changed.size() > n;)
+			{
+				n = changed.size();
+				ok = collect(changed, settle);
+			}
+#endif
+			std::sort(changed.begin() + first, changed.end());
+			changed.erase(std::unique(changed.begin() + first, changed.end()), changed.end());
+			return ok;
+		}
+
+		const std::filesystem::path& directory() const { return _dir; }
+
+		// How often the fallback rescans the tree; a rescan stats every file, so its cost
+		// grows with the tree. No effect with inotify or ReadDirectoryChangesW.
+		void rescan(std::chrono::milliseconds every)
+		{
+#if !defined(_WIN32) && !defined(__linux__)
+			_rescan = every;
+#else
+			(void)every;
+#endif
+		}
+
+	private:
+		static constexpr std::chrono::milliseconds settle{ 50 };
+
+#if defined(_WIN32)
+		// Starts the next asynchronous read of changes into the buffer.
+		bool request()
+		{
+			_overlapped = {};
+			_overlapped.hEvent = _event;
+
+			const DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE;
+
+			_pending = ReadDirectoryChangesW(_handle, _buffer.data(), static_cast<DWORD>(_buffer.size() * sizeof(DWORD)),
+				_recursive ? TRUE : FALSE, filter, nullptr, &_overlapped, nullptr) != 0;
+			return _pending;
+		}
+
+		bool collect(std::vector<std::filesystem::path>& changed, std::chrono::milliseconds timeout)
+		{
+			if (WaitForSingleObject(_event, static_cast<DWORD>(timeout.count())) != WAIT_OBJECT_0)
+				return true;
+
+			DWORD bytes = 0;
+			_pending = false;
+
+			if (!GetOverlappedResult(_handle, &_overlapped, &bytes, FALSE))
+				return false;
+
+			// No bytes: more changes than the buffer holds, so they were dropped.
+			if (bytes == 0)
+				addTree(_dir, &changed);
+
+			for (auto p = reinterpret_cast<const char*>(_buffer.data()); bytes != 0;)
+			{
+				const auto& n = *reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(p);
+
+				if (n.Action == FILE_ACTION_ADDED || n.Action == FILE_ACTION_MODIFIED || n.Action == FILE_ACTION_RENAMED_NEW_NAME)
+				{
+					auto path = _dir / std::wstring_view(n.FileName, n.FileNameLength / sizeof(WCHAR));
+
+					// A directory moved in brings its files without an event for each.
+					std::error_code ec;
+					if (!std::filesystem::is_directory(path, ec))
+						changed.push_back(std::move(path));
+					else if (_recursive && n.Action != FILE_ACTION_MODIFIED)
+						addTree(path, &changed);
+				}
+
+				if (n.NextEntryOffset == 0)
+					break;
+
+				p += n.NextEntryOffset;
+			}
+
+			return request();
+		}
+#elif defined(__linux__)
+		bool addWatch(const std::filesystem::path& dir)
+		{
+			const int wd = ::inotify_add_watch(_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+			if (wd < 0)
+				return false;
+
+			_dirs[wd] = dir;
+			return true;
+		}
+
+		bool collect(std::vector<std::filesystem::path>& changed, std::chrono::milliseconds timeout)
+		{
+			pollfd fd{ _fd, POLLIN, 0 };
+
+			const int ready = ::poll(&fd, 1, static_cast<int>(timeout.count()));
+			if (ready < 0)
+				return errno == EINTR;
+
+			if (ready == 0)
+				return true;
+
+			alignas(inotify_event) char buffer[16 * 1024];
+
+			for (;;)
+			{
+				const ssize_t size = ::read(_fd, buffer, sizeof(buffer));
+				if (size < 0)
+					return errno == EAGAIN || errno == EINTR;
+
+				for (ssize_t i = 0; i < size;)
+				{
+					const auto& e = *reinterpret_cast<const inotify_event*>(buffer + i);
+					i += static_cast<ssize_t>(sizeof(inotify_event) + e.len);
+
+					if (e.mask & IN_Q_OVERFLOW)
+					{
+						addTree(_dir, &changed);
+						continue;
+					}
+
+					const auto it = _dirs.find(e.wd);
+					if (it == _dirs.end())
+						continue;
+
+					if (e.mask & IN_IGNORED)
+					{
+						_dirs.erase(it);
+						continue;
+					}
+
+					if (e.len == 0)
+						continue;
+
+					auto path = it->second / e.name;
+
+					// New directories get their watch here, and files already in them are reported.
+					if (e.mask & IN_ISDIR)
+					{
+						if (_recursive)
+							addTree(path, &changed);
+					}
+					else if (e.mask & (IN_CLOSE_WRITE | IN_MOVED_TO))	// written and closed, or renamed into place
+						changed.push_back(std::move(path));
+				}
+			}
+		}
+#else
+		// Sleeps for timeout, and rescans only once the rescan interval has passed, so that
+		// the caller can check for cancellation more often than the tree is walked.
+		bool collect(std::vector<std::filesystem::path>& changed, std::chrono::milliseconds timeout)
+		{
+			const auto now = std::chrono::steady_clock::now();
+			const auto due = _scanned + _rescan;
+
+			if (now + timeout < due)
+			{
+				std::this_thread::sleep_for(timeout);
+				return true;
+			}
+
+			std::this_thread::sleep_until(due);
+			return scan(&changed);
+		}
+
+		// Rescans the tree; files that are new or differ in time or size since the last scan go to changed.
+		bool scan(std::vector<std::filesystem::path>* changed)
+		{
+			namespace fs = std::filesystem;
+
+			std::unordered_map<fs::path::string_type, std::pair<fs::file_time_type, uintmax_t>> next;
+			next.reserve(_snapshot.size());
+
+			auto add = [&](const fs::directory_entry& entry)
+				{
+					std::error_code ec;
+					if (!entry.is_regular_file(ec))
+						return;
+
+					const std::pair<fs::file_time_type, uintmax_t> state(entry.last_write_time(ec), entry.file_size(ec));
+
+					const auto it = _snapshot.find(entry.path().native());
+					if (changed && (it == _snapshot.end() || it->second != state))
+						changed->push_back(entry.path());
+
+					next.emplace(entry.path().native(), state);
+				};
+
+			std::error_code ec;
+			const auto options = fs::directory_options::skip_permission_denied;
+
+			if (_recursive)
+			{
+				for (fs::recursive_directory_iterator it(_dir, options, ec), end; !ec && it != end; it.increment(ec))
+					add(*it);
+			}
+			else
+			{
+				for (fs::directory_iterator it(_dir, options, ec), end; !ec && it != end; it.increment(ec))
+					add(*it);
+			}
+
+			_snapshot.swap(next);
+			_scanned = std::chrono::steady_clock::now();
+			return !ec;
+		}
+#endif
+
+#if defined(_WIN32) || defined(__linux__)
+		// Adds the files below dir to changed (when given). On Linux every directory of
+		// the tree also gets its watch.
+		bool addTree(const std::filesystem::path& dir, std::vector<std::filesystem::path>* changed)
+		{
+#if defined(__linux__)
+			if (!addWatch(dir))
+				return false;
+#endif
+			std::error_code ec;
+			bool ok = true;
+
+			for (std::filesystem::directory_iterator it(dir, std::filesystem::directory_options::skip_permission_denied, ec), end; !ec && it != end; it.increment(ec))
+			{
+				if (it->is_directory(ec) && !it->is_symlink(ec))
+				{
+					if (_recursive)
+						ok = addTree(it->path(), changed) && ok;
+				}
+				else if (changed && it->is_regular_file(ec))
+					changed->push_back(it->path());
+			}
+
+			return ok;
+		}
+#endif
+
+		std::filesystem::path _dir;
+		bool _recursive = false;
+#if defined(_WIN32)
+		HANDLE _handle = INVALID_HANDLE_VALUE;
+		HANDLE _event = nullptr;
+		OVERLAPPED _overlapped{};
+		std::vector<DWORD> _buffer;
+		bool _pending = false;
+#elif defined(__linux__)
+		int _fd = -1;
+		std::unordered_map<int, std::filesystem::path> _dirs;	// watch descriptor -> directory
+#else
+		std::unordered_map<std::filesystem::path::string_type, std::pair<std::filesystem::file_time_type, uintmax_t>> _snapshot;
+		std::chrono::milliseconds _rescan{ 5000 };
+		std::chrono::steady_clock::time_point _scanned;
+#endif
+	};
+
+	//-----------------------------------------------------------------------------------------
+	// Plan Output
+	//-----------------------------------------------------------------------------------------
+
+	// Formats of -plan, in the order of plan_formats
+	enum class PlanFormat
+	{
+		None,
+		Jsonl,	// {"source":"in/a.txt","target":"out/a.csv","size":1024} per line
+		Nul		// source, target and size, each followed by a NUL byte
+	};
+
+	// Writes -plan records through one large buffer with fwrite. NUL-delimited records
+	// survive any byte a path may hold. Paths are written as UTF-8 on Windows and as their
+	// bytes elsewhere.
+	class plan_writer
+	{
+	public:
+		explicit plan_writer(PlanFormat format, std::FILE* out = stdout, size_t buffer = 1 << 20)
+			: format(format), out(out), capacity(buffer)
+		{
+#ifdef _WIN32
+			// No \n to \r\n translation: the records are bytes.
+			_setmode(_fileno(out), _O_BINARY);
+#endif
+			data.reserve(buffer + 1024);
+		}
+
+		plan_writer(const plan_writer&) = delete;
+		plan_writer& operator=(const plan_writer&) = delete;
+
+		~plan_writer() { flush(); }
+
+		void write(const cmd_pair& pair, uint64_t size)
+		{
+			char number[24];
+			const auto end = std::to_chars(number, number + sizeof(number), size).ptr;
+			const std::string_view digits(number, static_cast<size_t>(end - number));
+
+			if (format == PlanFormat::Nul)
+			{
+				data += text(pair.source);
+				data += '\0';
+				data += text(pair.target);
+				data += '\0';
+				data += digits;
+				data += '\0';
+			}
+			else
+			{
+				data += "{\"source\":\"";
+				escape(text(pair.source));
+				data += "\",\"target\":\"";
+				escape(text(pair.target));
+				data += "\",\"size\":";
+				data += digits;
+				data += "}\n";
+			}
+
+			if (data.size() >= capacity)
+				flush();
+		}
+
+		bool flush()
+		{
+			const bool ok = std::fwrite(data.data(), 1, data.size(), out) == data.size() && std::fflush(out) == 0;
+			data.clear();
+			return ok;
+		}
+
+	private:
+#ifdef _WIN32
+		std::string text(const std::filesystem::path& p)
+		{
+			const auto u8 = p.u8string();	// std::string in C++17, std::u8string in C++20
+			return std::string(reinterpret_cast<const char*>(u8.data()), u8.size());
+		}
+#else
+		static const std::string& text(const std::filesystem::path& p) { return p.native(); }
+#endif
+
+		// JSON string escaping; bytes from 0x80 up pass through.
+		void escape(std::string_view s)
+		{
+			static constexpr char hex[] = "0123456789abcdef";
+
+			for (const char ch : s)
+			{
+				const auto c = static_cast<unsigned char>(ch);
+
+				if (c == '"' || c == '\\')
+				{
+					data += '\\';
+					data += ch;
+				}
+				else if (c == '\n')
+					data += "\\n";
+				else if (c == '\t')
+					data += "\\t";
+				else if (c == '\r')
+					data += "\\r";
+				else if (c < 0x20)
+				{
+					data += "\\u00";
+					data += hex[c >> 4];
+					data += hex[c & 15];
+				}
+				else
+					data += ch;
+			}
+		}
+
+		const PlanFormat format;
+		std::FILE* const out;
+		const size_t capacity;
+		std::string data;
+	};
+
+	//-----------------------------------------------------------------------------------------
+	// Content Hashing and Manifest
+	//-----------------------------------------------------------------------------------------
+
+	// XXH64 of a memory block (little-endian byte order)
+	inline uint64_t hash64(const void* data, size_t size, uint64_t seed = 0)
+	{
+		constexpr uint64_t P1 = 11400714785074694791ull;
+		constexpr uint64_t P2 = 14029467366897019727ull;
+		constexpr uint64_t P3 = 1609587929392839161ull;
+		constexpr uint64_t P4 = 9650029242287828579ull;
+		constexpr uint64_t P5 = 2870177450012600261ull;
+
+		auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+		auto read64 = [](const unsigned char* p) { uint64_t v; std::memcpy(&v, p, 8); return v; };
+		auto read32 = [](const unsigned char* p) { uint32_t v; std::memcpy(&v, p, 4); return v; };
+		auto round = [&](uint64_t acc, uint64_t input) { return rotl(acc + input * P2, 31) * P1; };
+		auto merge = [&](uint64_t acc, uint64_t v) { return (acc ^ round(0, v)) * P1 + P4; };
+
+		const auto* p = static_cast<const unsigned char*>(data);
+		const auto* end = p + size;
+		uint64_t h;
+
+		if (size >= 32)
+		{
+			uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+
+			for (; end - p >= 32; p += 32)
+			{
+				v1 = round(v1, read64(p));
+				v2 = round(v2, read64(p + 8));
+				v3 = round(v3, read64(p + 16));
+				v4 = round(v4, read64(p + 24));
+			}
+
+			h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+			h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+		}
+		else
+			h = seed + P5;
+
+		h += size;
+
+		for (; end - p >= 8; p += 8)
+			h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+
+		if (end - p >= 4)
+		{
+			h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+			p += 4;
+		}
+
+		for (; p < end; ++p)
+			h = rotl(h ^ (*p * P5), 11) * P1;
+
+		h ^= h >> 33;
+		h *= P2;
+		h ^= h >> 29;
+		h *= P3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	// XXH64 of a whole file, read through a memory mapping
+	inline bool hashFile(const std::filesystem::path& file, uint64_t& hash)
+	{
+		mapped_file map;
+		if (!map.open(file))
+			return false;
+
+		const auto view = map.view();
+		hash = hash64(view.data(), view.size());
+		return true;
+	}
+
+	// Key of a (source, target) pair: the hash of both paths
+	inline uint64_t pairKey(const cmd_pair& pair)
+	{
+		const auto& s = pair.source.native();
+		const auto& t = pair.target.native();
+
+		const uint64_t h = hash64(s.data(), s.size() * sizeof(s[0]));
+		return hash64(t.data(), t.size() * sizeof(t[0]), h);
+	}
+
+	// Remembers, per (source, target) pair, the size, modification time and content hash
+	// the source had when the pair was last converted. With a manifest attached to a
+	// parser, -incremental compares against it instead of the target's modification time:
+	// equal size and time mean unchanged, a different size means changed, and only a
+	// different time with equal size makes the source get rehashed.
+	//
+	// The file is a header followed by fixed-size records sorted by key. It is memory-mapped
+	// and searched in place, so loading costs the same for a thousand or millions of pairs.
+	class cmd_manifest
+	{
+	public:
+		cmd_manifest() = default;
+		cmd_manifest(const cmd_manifest&) = delete;
+		cmd_manifest& operator=(const cmd_manifest&) = delete;
+
+		// Maps an existing manifest; a missing file gives an empty manifest. Returns false
+		// for a file that exists but is not a manifest of this format.
+		bool open(const std::filesystem::path& file)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			_file = file;
+			_map = mapped_file();
+			_entries = {};
+			_changes.clear();
+
+			std::error_code ec;
+			if (!std::filesystem::exists(file, ec))
+				return true;
+
+			if (!_map.open(file))
+				return false;
+
+			const auto view = _map.view();
+
+			header h{};
+			if (view.size() < sizeof(header))
+				return invalid();
+
+			std::memcpy(&h, view.data(), sizeof(header));
+
+			if (std::memcmp(h.magic, magic, sizeof(h.magic)) != 0 || h.order != order ||
+				(view.size() - sizeof(header)) / sizeof(entry) < h.count)
+				return invalid();
+
+			_entries = view.substr(sizeof(header), static_cast<size_t>(h.count) * sizeof(entry));
+			return true;
+		}
+
+		// True when the source is known to be unchanged since the pair was recorded.
+		bool unchanged(const cmd_pair& pair, const file_info& source)
+		{
+			const uint64_t k = key(pair);
+
+			entry r{};
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!find(k, r))
+					return false;
+			}
+
+			if (r.size != source.size)
+				return false;
+
+			if (r.mtime == source.mtime)
+				return true;
+
+			uint64_t h = 0;
+			if (!hashFile(pair.source, h) || h != r.hash)
+				return false;
+
+			// Same content with a new time: remember the time so the next check is a stat only.
+			r.mtime = source.mtime;
+
+			std::lock_guard<std::mutex> lock(mutex);
+			_changes[k] = r;
+			return true;
+		}
+
+		// Records the current state of a converted source (safe to call from workers).
+		bool record(const cmd_pair& pair)
+		{
+			const file_info info = statFile(pair.source);
+
+			entry r{};
+			r.key = key(pair);
+			r.size = info.size;
+			r.mtime = info.mtime;
+
+			if (!hashFile(pair.source, r.hash))
+				return false;
+
+			std::lock_guard<std::mutex> lock(mutex);
+			_changes[r.key] = r;
+			return true;
+		}
+
+		// Writes the manifest with all recorded changes (to a temporary file that then
+		// replaces the old one) and maps the new file.
+		bool save()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (_changes.empty() || _file.empty())
+				return true;
+
+			std::vector<entry> merged;
+			merged.reserve(_entries.size() / sizeof(entry) + _changes.size());
+
+			for (size_t i = 0; i < _entries.size() / sizeof(entry); ++i)
+			{
+				entry r{};
+				std::memcpy(&r, _entries.data() + i * sizeof(entry), sizeof(entry));
+				if (_changes.find(r.key) == _changes.end())
+					merged.push_back(r);
+			}
+
+			for (const auto& c : _changes)
+				merged.push_back(c.second);
+
+			std::sort(merged.begin(), merged.end(), [](const entry& a, const entry& b) { return a.key < b.key; });
+
+			// The old mapping must be released before the file can be replaced (Windows).
+			_map = mapped_file();
+			_entries = {};
+
+			auto temp = _file;
+			temp += ".tmp";
+
+			std::FILE* out = openFile(temp);
+			if (!out)
+				return false;
+
+			header h{};
+			std::memcpy(h.magic, magic, sizeof(h.magic));
+			h.order = order;
+			h.count = merged.size();
+
+			bool ok = std::fwrite(&h, sizeof(h), 1, out) == 1;
+			ok = ok && std::fwrite(merged.data(), sizeof(entry), merged.size(), out) == merged.size();
+			ok = std::fclose(out) == 0 && ok;
+
+			std::error_code ec;
+			if (ok)
+				std::filesystem::rename(temp, _file, ec);
+
+			if (!ok || ec)
+			{
+				std::filesystem::remove(temp, ec);
+				return false;
+			}
+
+			_changes.clear();
+
+			if (!_map.open(_file))
+				return false;
+
+			_entries = _map.view().substr(sizeof(header), merged.size() * sizeof(entry));
+			return true;
+		}
+
+	private:
+		static constexpr char magic[8] = { 'C', 'M', 'D', 'A', 'R', 'G', 'S', '1' };
+		static constexpr uint32_t order = 0x01020304;	// detects files written on a machine of other byte order
+
+		struct header
+		{
+			char magic[8];
+			uint32_t order;
+			uint32_t reserved;
+			uint64_t count;
+		};
+
+		struct entry
+		{
+			uint64_t key;		// hash of the source and target paths
+			uint64_t size;
+			int64_t mtime;
+			uint64_t hash;		// XXH64 of the source content
+		};
+
+		static uint64_t key(const cmd_pair& pair) { return pairKey(pair); }
+
+		// Binary search over the mapped records, then the changes of this run.
+		bool find(uint64_t k, entry& r) const
+		{
+			const auto c = _changes.find(k);
+			if (c != _changes.end())
+			{
+				r = c->second;
+				return true;
+			}
+
+			size_t lo = 0, hi = _entries.size() / sizeof(entry);
+			while (lo < hi)
+			{
+				const size_t mid = lo + (hi - lo) / 2;
+				std::memcpy(&r, _entries.data() + mid * sizeof(entry), sizeof(entry));
+
+				if (r.key == k)
+					return true;
+
+				if (r.key < k)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			return false;
+		}
+
+		bool invalid()
+		{
+			_map = mapped_file();
+			_entries = {};
+			return false;
+		}
+
+		static std::FILE* openFile(const std::filesystem::path& file)
+		{
+#ifdef _WIN32
+			return _wfopen(file.c_str(), L"wb");
+#else
+			return std::fopen(file.c_str(), "wb");
+#endif
+		}
+
+		std::filesystem::path _file;
+		mapped_file _map;
+		std::string_view _entries;
+		std::unordered_map<uint64_t, entry> _changes;
+		mutable std::mutex mutex;
+	};
+
+	// Append-only record of the pairs a run has finished, for -resume. A finished pair
+	// appends its key at once, so a process that dies loses nothing it finished; the file
+	// is synced every sync_every pairs or sync_interval, so a power cut loses little more.
+	// The keys are those of the manifest (a hash of the source and target paths) rather
+	// than list positions, so a journal stays valid when the work list is not the same
+	// from run to run (new files, -incremental, another -shard or order).
+	//
+	// The file is a header followed by 8-byte keys; a key cut short by a crash is dropped.
+	class cmd_journal
+	{
+	public:
+		static constexpr size_t sync_every = 256;
+		static constexpr std::chrono::seconds sync_interval{ 1 };
+
+		cmd_journal() = default;
+		cmd_journal(const cmd_journal&) = delete;
+		cmd_journal& operator=(const cmd_journal&) = delete;
+
+		~cmd_journal() { close(); }
+
+		// Reads the keys of an existing journal; a missing file, or one cut short before
+		// the end of its header (a crash right after it was created), gives an empty journal.
+		// Returns false for a file whose header is not the one of this format.
+		bool load(const std::filesystem::path& file)
+		{
+			_file = file;
+			_done.clear();
+			_stored = 0;
+
+			std::error_code ec;
+			if (!std::filesystem::exists(file, ec))
+				return true;
+
+			mapped_file map;
+			if (!map.open(file))
+				return false;
+
+			const auto view = map.view();
+
+			// open() writes the header again.
+			header h{};
+			if (view.size() < sizeof(header))
+				return true;
+
+			std::memcpy(&h, view.data(), sizeof(header));
+
+			if (std::memcmp(h.magic, magic, sizeof(h.magic)) != 0 || h.order != order)
+				return false;
+
+			_done.resize((view.size() - sizeof(header)) / sizeof(uint64_t));
+			if (!_done.empty())
+				std::memcpy(_done.data(), view.data() + sizeof(header), _done.size() * sizeof(uint64_t));
+
+			std::sort(_done.begin(), _done.end());
+			_stored = _done.size();
+			return true;
+		}
+
+		const std::filesystem::path& file() const { return _file; }
+
+		// Number of finished pairs read from the journal
+		size_t size() const { return _done.size(); }
+
+		// True when an earlier run finished the pair.
+		bool finished(const cmd_pair& pair) const
+		{
+			return std::binary_search(_done.begin(), _done.end(), pairKey(pair));
+		}
+
+		// Opens the journal for appending, creating it when it does not exist. A key cut
+		// short at the end is cut off, so the keys that follow stay aligned.
+		bool open()
+		{
+			close();
+
+			header h{};
+			std::memcpy(h.magic, magic, sizeof(h.magic));
+			h.order = order;
+
+			const uint64_t end = sizeof(header) + _stored * sizeof(uint64_t);
+#ifdef _WIN32
+			_handle = CreateFileW(_file.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (_handle == INVALID_HANDLE_VALUE)
+				return false;
+
+			LARGE_INTEGER at{};
+			at.QuadPart = static_cast<LONGLONG>(end);
+
+			bool ok = SetFilePointerEx(_handle, at, nullptr, FILE_BEGIN) && SetEndOfFile(_handle);
+
+			if (ok && _stored == 0)
+			{
+				at.QuadPart = 0;
+				ok = SetFilePointerEx(_handle, at, nullptr, FILE_BEGIN) && writeAll(&h, sizeof(h));
+			}
+#else
+			_handle = ::open(_file.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+			if (_handle < 0)
+				return false;
+
+			bool ok = ::ftruncate(_handle, static_cast<off_t>(_stored == 0 ? 0 : end)) == 0;
+
+			if (ok)
+				ok = ::lseek(_handle, 0, SEEK_END) >= 0 && (_stored != 0 || writeAll(&h, sizeof(h)));
+#endif
+			_unsynced = 0;
+			_synced = std::chrono::steady_clock::now();
+			_failed = !ok;
+
+			if (!ok)
+				close();
+
+			return ok;
+		}
+
+		// Appends a finished pair (safe to call from workers).
+		bool record(const cmd_pair& pair)
+		{
+			const uint64_t key = pairKey(pair);
+			bool sync = false;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				if (!isOpen() || !writeAll(&key, sizeof(key)))
+				{
+					_failed = true;
+					return false;
+				}
+
+				// A later open() (another run on the same parser) keeps this key.
+				++_stored;
+
+				const auto now = std::chrono::steady_clock::now();
+				if (++_unsynced >= sync_every || now - _synced >= sync_interval)
+				{
+					_unsynced = 0;
+					_synced = now;
+					sync = true;
+				}
+			}
+
+			// Outside the lock, so the other workers go on appending meanwhile.
+			if (sync)
+				flushFile();
+
+			return true;
+		}
+
+		// Syncs and closes the journal; false when a key could not be written.
+		bool close()
+		{
+			if (!isOpen())
+				return !_failed;
+
+			bool ok = flushFile();
+#ifdef _WIN32
+			ok = CloseHandle(_handle) != 0 && ok;
+			_handle = INVALID_HANDLE_VALUE;
+#else
+			ok = ::close(_handle) == 0 && ok;
+			_handle = -1;
+#endif
+			return ok && !_failed;
+		}
+
+	private:
+		static constexpr char magic[8] = { 'C', 'M', 'D', 'J', 'R', 'N', 'L', '1' };
+		static constexpr uint32_t order = 0x01020304;
+
+		struct header
+		{
+			char magic[8];
+			uint32_t order;
+			uint32_t reserved;
+		};
+
+		bool isOpen() const
+		{
+#ifdef _WIN32
+			return _handle != INVALID_HANDLE_VALUE;
+#else
+			return _handle >= 0;
+#endif
+		}
+
+		bool writeAll(const void* data, size_t size)
+		{
+			const char* p = static_cast<const char*>(data);
+			while (size > 0)
+			{
+#ifdef _WIN32
+				DWORD done = 0;
+				if (!WriteFile(_handle, p, static_cast<DWORD>(size), &done, nullptr) || done == 0)
+					return false;
+#else
+				const ssize_t done = ::write(_handle, p, size);
+				if (done < 0 && errno == EINTR)
+					continue;
+				if (done <= 0)
+					return false;
+#endif
+				p += done;
+				size -= static_cast<size_t>(done);
+			}
+			return true;
+		}
+
+		bool flushFile()
+		{
+#ifdef _WIN32
+			return FlushFileBuffers(_handle) != 0;
+#elif defined(__APPLE__)
+			return ::fsync(_handle) == 0;
+#else
+			return ::fdatasync(_handle) == 0;
+#endif
+		}
+
+		std::filesystem::path _file;
+		std::vector<uint64_t> _done;	// sorted keys of the earlier runs
+		size_t _stored = 0;	// whole keys in the file: loaded, then recorded
+		size_t _unsynced = 0;
+		std::chrono::steady_clock::time_point _synced;
+		bool _failed = false;
+#ifdef _WIN32
+		HANDLE _handle = INVALID_HANDLE_VALUE;
+#else
+		int _handle = -1;
+#endif
+		std::mutex mutex;
+	};
+
+	//-----------------------------------------------------------------------------------------
+	// Instrumentation
+	//-----------------------------------------------------------------------------------------
+
+	// Parser phases reported to an instrumentation sink
+	enum class Phase
+	{
+		Arguments,			// sorting argv into flags and files, reading @file lists
+		Flags,				// flag and option matching
+		Validation,			// existence, extension and directory checks
+		TargetDerivation,	// building the target path of each source
+		DirectoryExpansion,	// walking source directories
+		Count
+	};
+
+	// Parser counters reported to an instrumentation sink
+	enum class Counter
+	{
+		StatCalls,			// filesystem status calls
+		DirectoryEntries,	// entries read while expanding source directories
+		PathsBuilt,			// paths stored in sources and pairs (not allocations: a short path may need none)
+		Accepted,			// accepted sources
+		Rejected,			// sources and directory entries that were not accepted
+		UpToDate,			// accepted sources skipped by -incremental
+		Count
+	};
+
+#ifdef CMDARGS_INSTRUMENT
+	// Receives the time spent in each phase and the counter totals after every parse
+	// (and after every stream run). Only available when CMDARGS_INSTRUMENT is defined;
+	// without it the parser hooks are empty inline functions and compile to nothing.
+	struct cmd_sink
+	{
+		virtual ~cmd_sink() = default;
+		virtual void phase(Phase phase, std::chrono::nanoseconds elapsed) = 0;
+		virtual void counter(Counter counter, uint64_t value) = 0;
+	};
+#endif
+
+	//-----------------------------------------------------------------------------------------
+	// Parse Result
+	//-----------------------------------------------------------------------------------------
+
+	// Everything one parse produces. Flag and option values are kept in the order of
+	// cmd_flags and cmd_options, so a parser in Local mode never touches the globals.
+	struct cmd_result
+	{
+		Status status = Status::Ok;
+		std::string message;
+
+		std::filesystem::path source;
+		std::filesystem::path target;
+		std::vector<std::filesystem::path> sources;
+		std::vector<cmd_pair> pairs;
+
+		// Number of sources left out by -incremental because their target is up to date
+		size_t upToDate = 0;
+
+		// Number of pairs left out by -resume because an earlier run finished them
+		size_t resumed = 0;
+
+		// Stream mode (source "-"): sources are read from stdin by run(), and targets go
+		// to targetDir (next to each source when it is empty).
+		bool streaming = false;
+		std::filesystem::path targetDir;
+
+		// Directories below the target directory that run() creates before the workers
+		// start (source directory mirrored into a target directory). Sorted, so every
+		// parent comes before its children.
+		std::vector<std::filesystem::path> directories;
+
+		// compactPaths(): the expanded directory sources, which then leave sources and pairs empty
+		cmd_worklist work;
+
+		// -keepgoing: the rejected sources; status stays Ok and the valid sources are in pairs
+		std::vector<cmd_error> errors;
+
+		std::vector<bool> flags;
+		std::vector<cmd_value> options;
+
+		// Storage behind the String option values (shared, so copies of a result stay valid)
+		std::vector<std::shared_ptr<const std::string>> strings;
+
+		// Value of a registered flag (the default when it is not registered)
+		bool flag(const cmd_flag& f) const
+		{
+			const auto it = std::find(cmd_flags.begin(), cmd_flags.end(), &f);
+			return it == cmd_flags.end() ? f.byDefault() : flags[it - cmd_flags.begin()];
+		}
+
+		// Value of a registered option (the default when it is not registered)
+		const cmd_value& value(const cmd_option& o) const
+		{
+			const auto it = std::find(cmd_options.begin(), cmd_options.end(), &o);
+			return it == cmd_options.end() ? o.byDefault() : options[it - cmd_options.begin()];
+		}
+
+		// Number of a registered option (the Enum choice index, 0 for String)
+		long long option(const cmd_option& o) const { return value(o).number; }
+
+		// Text of a registered String option, or the name of the selected Enum choice
+		std::string_view text(const cmd_option& o) const { return o.text(value(o)); }
+	};
+
+	//-----------------------------------------------------------------------------------------
+	// Command-line Argument Parser Class
+	//-----------------------------------------------------------------------------------------
+
+	class CmdArgumentParser
+	{
+	public:
+		explicit CmdArgumentParser(Mode mode = Mode::Global) : _mode(mode) {}
+
+		std::filesystem::path source() const { return _result.source; }
+		std::filesystem::path target() const { return _result.target; }
+
+		const std::vector<std::filesystem::path>& sources() const { return _result.sources; }
+		const std::vector<cmd_pair>& pairs() const { return _result.pairs; }
+		const cmd_worklist& work() const { return _result.work; }
+
+		const cmd_result& result() const { return _result; }
+		Status status() const { return _result.status; }
+		const std::string& message() const { return _result.message; }
+
+		bool flag(const cmd_flag& f) const { return _result.flag(f); }
+		long long option(const cmd_option& o) const { return _result.option(o); }
+		std::string_view text(const cmd_option& o) const { return _result.text(o); }
+
+		// Number of filesystem status calls made by the last parse
+		size_t statCalls() const { return _status.statCalls(); }
+
+#ifdef CMDARGS_INSTRUMENT
+		// Sets the sink that receives phase timings and counters (nullptr to disable)
+		void instrument(cmd_sink* sink) { _sink = sink; }
+#endif
+
+		// Runs fn over all parsed pairs on -jobs worker threads. In stream mode the pairs
+		// are read from stdin while the workers are already busy.
+		// With a manifest attached, every successful pair is recorded and the manifest is
+		// saved when the run is over.
+		// cancel, when given, stops the run early (see cmd_cancel).
+		// With -watch, run() then goes on with the sources that change (see runWatch) and
+		// only returns when cancel is set. With -resume, every finished pair is journaled.
+		// With -plan, fn is not called: the pairs are printed instead (see runPlan).
+		bool run(const pair_callback& fn, const cmd_cancel* cancel = nullptr)
+		{
+			// -plan leaves the disk as it is: no target directories, no journal.
+			if (!planning() && !createDirectories())
+				return false;
+
+			// The watch is in place before the first run, so changes made during it are not missed.
+			directory_watch watcher;
+			watcher.rescan(std::chrono::milliseconds(option(rescan)));
+			if (flag(watch) && !watcher.open(_result.source, flag(recursive)))
+				return runError(Msg::SourceDirectoryNotWatched, _result.source);
+
+			if (planning())
+				return runPlan(watcher, cancel);
+
+			if (_journal && !_journal->open())
+				return runError(Msg::JournalNotWritten, _journal->file());
+
+			pair_callback recorded;
+			if (_manifest || _journal)
+			{
+				recorded = [&](const cmd_pair& pair)
+					{
+						const bool ok = fn(pair);
+						if (ok && _manifest)
+							_manifest->record(pair);
+						if (ok && _journal)
+							_journal->record(pair);
+						return ok;
+					};
+			}
+
+			const pair_callback& call = _manifest || _journal ? recorded : fn;
+
+			bool ok = runOnce(call, cancel);
+
+			if (_manifest)
+				ok = _manifest->save() && ok;
+
+			if (flag(watch))
+				ok = runWatch(watcher, call, cancel) && ok;
+
+			if (_journal && !_journal->close())
+				return runError(Msg::JournalNotWritten, _journal->file());
+
+			return ok;
+		}
+
+		// Attaches a manifest for content-based -incremental checks (nullptr to detach)
+		void manifest(cmd_manifest* m) { _manifest = m; }
+
+		// Opens every accepted source during the parse and hands it out in cmd_pair::file,
+		// with a read-only mapping of the whole file when map is set. Batch sources are
+		// opened instead of stat'ed, so a source takes one metadata round trip, and the
+		// converter reads the file that was validated (no window to replace it in between).
+		// Mapping many files at once may hit the system's limit on mappings. A mapped source
+		// holds no descriptor, but an unmapped one keeps its handle until the pair is gone, so
+		// without map the sources of one parse count against the open file limit.
+		void openSources(bool open = true, bool map = false)
+		{
+			_open = open;
+			_map = open && map;
+		}
+
+		// Keeps an expanded source directory in work() (a cmd_worklist) instead of sources()
+		// and pairs(): a few bytes per file instead of a path per source and target. run()
+		// builds each pair when a worker takes it. openSources does not apply to the list.
+		void compactPaths(bool compact = true) { _compact = compact; }
+
+		// Parses a command line. In Global mode the results are also published to the
+		// cmd:: globals; in Local mode several parsers may run concurrently.
+		bool parse(int argc, const char* const argv[])
+		{
+			check();
+
+			const bool ok = parseArguments(argc, argv);
+
+			flushInstrumentation();
+
+			if (_mode == Mode::Global)
+				report();
+
+			return ok;
+		}
+
+	private:
+
+		// Times one phase for the instrumentation sink; empty without CMDARGS_INSTRUMENT.
+		struct phase_scope
+		{
+#ifdef CMDARGS_INSTRUMENT
+			phase_scope(CmdArgumentParser& parser, Phase phase)
+				: total(parser._phases[static_cast<size_t>(phase)]), start(std::chrono::steady_clock::now()) {
+			}
+
+			~phase_scope() { total += std::chrono::steady_clock::now() - start; }
+
+			std::chrono::nanoseconds& total;
+			const std::chrono::steady_clock::time_point start;
+#else
+			phase_scope(CmdArgumentParser&, Phase) {}
+#endif
+		};
+
+		void count(Counter counter, uint64_t n = 1)
+		{
+#ifdef CMDARGS_INSTRUMENT
+			_counters[static_cast<size_t>(counter)] += n;
+#else
+			(void)counter;
+			(void)n;
+#endif
+		}
+
+		// Hands the totals to the sink and starts over.
+		void flushInstrumentation()
+		{
+#ifdef CMDARGS_INSTRUMENT
+			_counters[static_cast<size_t>(Counter::StatCalls)] = _status.statCalls();
+
+			if (_sink)
+			{
+				for (size_t i = 0; i < _phases.size(); ++i)
+					_sink->phase(static_cast<Phase>(i), _phases[i]);
+
+				for (size_t i = 0; i < _counters.size(); ++i)
+					_sink->counter(static_cast<Counter>(i), _counters[i]);
+			}
+
+			_phases.fill(std::chrono::nanoseconds::zero());
+			_counters.fill(0);
+#endif
+		}
+
+		bool parseArguments(int argc, const char* const argv[])
+		{
+			// The arguments are only viewed here; paths are created for accepted files only.
+			std::vector<std::string_view> args;
+			std::vector<std::string_view> flags;
+			std::vector<std::string_view> files;
+
+			// Argument files stay mapped while their lines are being parsed.
+			std::vector<mapped_file> lists;
+
+			if (!sortArguments(argc, argv, args, flags, files, lists))
+				return false;
+
+			if (!parseFlags(flags, files.size()))
+				return false;
+
+			_incremental = flag(incremental);
+			_keepGoing = flag(keepgoing);
+
+			if (!parseShard(text(shard)))
+				return err(Msg::InvalidOptionValue, "-shard=" + std::string(text(shard)));
+
+			if (!(target_ext.empty() ? parseSingleFile(files) : parseSourceTargetFiles(files)))
+				return false;
+
+			if (flag(watch) && (_result.streaming || !_status.isDirectory(_result.source)))
+				return err(Msg::WatchNeedsSourceDirectory);
+
+			if (!dropCollisions())
+				return false;
+
+			if (!text(resume).empty() && !resumeFrom(std::filesystem::path(text(resume))))
+				return false;
+
+			for (auto& pair : _result.pairs)
+				pair.conversion = conversionOf(pair.source, pair.target);
+
+			if (_open && !openPairs())
+				return false;
+
+			if (flag(largestfirst))
+				orderLargestFirst();
+
+			return true;
+		}
+
+		// Expands @file lists and sorts the arguments into flags (with option values) and files.
+		bool sortArguments(int argc, const char* const argv[], std::vector<std::string_view>& args,
+			std::vector<std::string_view>& flags, std::vector<std::string_view>& files, std::vector<mapped_file>& lists)
+		{
+			phase_scope scope(*this, Phase::Arguments);
+
+			args.reserve(argc > 1 ? static_cast<size_t>(argc - 1) : 0);
+
+			for (int i = 1; i < argc; ++i)
+			{
+				const std::string_view arg = argv[i] ? argv[i] : "";
+				if (arg.empty()) continue;
+
+				// @file: every line of the file is one argument.
+				if (arg.size() > 1 && arg.front() == '@')
+				{
+					const std::filesystem::path list(arg.substr(1));
+
+					mapped_file file;
+					if (!file.open(list))
+						return err(Msg::ArgumentFileNotReadable, {}, list);
+
+					splitLines(file.view(), args);
+					lists.push_back(std::move(file));
+					continue;
+				}
+
+				args.push_back(arg);
+			}
+
+			files.reserve(args.size());
+
+			for (size_t i = 0; i < args.size(); ++i)
+			{
+				const auto arg = args[i];
+
+				// A lone "-" is the stdin source, not a flag.
+				if (arg.front() == '-' && arg.size() > 1)
+				{
+					flags.push_back(arg);
+
+					// Options may take their value from the next argument (-jobs 8).
+					if (i + 1 < args.size() && optionTable().find(flagName(arg)) != name_table<cmd_option>::npos)
+						flags.push_back(args[++i]);
+				}
+				else
+					files.push_back(arg);
+			}
+
+			return true;
+		}
+
+		template <class T, class V>
+		static bool contains(const T& list, const V& value)
+		{
+			return std::find(list.begin(), list.end(), value) != list.end();
+		}
+
+		bool err(const std::string& msg)
+		{
+			_result.status = Status::Error;
+			_result.message = msg;
+			return false;
+		}
+
+		bool err(Msg m, const std::string& s = std::string(), const std::filesystem::path& p = std::filesystem::path())
+		{
+			return err(format(m, s, p));
+		}
+
+		bool info(Status status, const std::string& msg)
+		{
+			_result.status = status;
+			_result.message = msg;
+			return false;
+		}
+
+		// Global mode: hand the results to the globals, print errors and exit on help/version.
+		void report()
+		{
+			if (_result.status == Status::Error)
+			{
+				cmd_output(Status::Error, "Error: " + _result.message + "\n");
+				return;
+			}
+
+			if (_result.status != Status::Ok)
+			{
+				cmd_output(_result.status, _result.message + "\n");
+				std::exit(0);
+			}
+
+			reportErrors();
+
+			cmd::source = _result.source;
+			cmd::target = _result.target;
+			cmd::sources = _result.sources;
+			cmd::pairs = _result.pairs;
+
+			for (size_t i = 0; i < cmd_flags.size(); ++i)
+				*cmd_flags[i] = _result.flags[i];
+
+			for (size_t i = 0; i < cmd_options.size(); ++i)
+			{
+				cmd_value v = _result.options[i];
+
+				// The parser's copy of a String value goes with the parser; the global option keeps its own.
+				if (cmd_options[i]->kind() == OptionKind::String)
+				{
+					auto& text = globalTexts()[i];
+					text.assign(v.text);
+					v.text = text;
+				}
+
+				*cmd_options[i] = v;
+			}
+		}
+
+		// Storage behind the String values of the global options, one per registered option
+		static std::array<std::string, cmd_options.size()>& globalTexts()
+		{
+			static std::array<std::string, cmd_options.size()> texts;
+			return texts;
+		}
+
+		// An error found by run(): stored like a parse error and printed in Global mode.
+		bool runError(Msg m, const std::filesystem::path& p)
+		{
+			err(m, {}, p);
+
+			if (_mode == Mode::Global)
+				report();
+
+			return false;
+		}
+
+		// Global mode: prints the -keepgoing errors and hands them to cmd::errors.
+		void reportErrors()
+		{
+			for (const auto& e : _result.errors)
+				cmd_output(Status::Error, "Error: " + format(e.msg, {}, e.path) + "\n");
+
+			cmd::errors = _result.errors;
+		}
+
+		void check()
+		{
+			if (_mode == Mode::Global)
+			{
+				cmd::errors.clear();
+				cmd::source.clear();
+				cmd::target.clear();
+				cmd::sources.clear();
+				cmd::pairs.clear();
+
+				for (auto* f : cmd_flags) f->clear();
+				for (auto* o : cmd_options) o->clear();
+			}
+
+			_result = cmd_result();
+			_cwd.clear();
+			_status.clear();
+			_incremental = false;
+			_keepGoing = false;
+			_journal.reset();
+
+			for (auto* f : cmd_flags) _result.flags.push_back(f->byDefault());
+			for (auto* o : cmd_options) _result.options.push_back(o->byDefault());
+
+			if (cmd::source_ext.empty())
+				throw std::runtime_error("Error: source_ext is not defined.");
+			if (!contains(cmd_flags, &help))
+				throw std::runtime_error("Error: cmd_flags must contain 'help' flag.");
+			if (!contains(cmd_flags, &version))
+				throw std::runtime_error("Error: cmd_flags must contain 'version' flag.");
+			if (cmd_flags.size() < 3)
+				throw std::runtime_error("Error: cmd_flags is not defined.");
+		}
+
+		bool parseFlags(const std::vector<std::string_view>& flags, const size_t countFiles)
+		{
+			phase_scope scope(*this, Phase::Flags);
+
+			size_t countFlags = 0;
+
+			for (size_t i = 0; i < flags.size(); ++i)
+			{
+				const auto arg = flags[i];
+				const auto name = flagName(arg);
+
+				if (const size_t f = flagTable().find(name); f != name_table<cmd_flag>::npos)
+				{
+					_result.flags[f] = true;
+					++countFlags;
+					continue;
+				}
+
+				// Options are given as -name=value, or as -name followed by the value (see parseArguments).
+				const size_t eq = name.find('=');
+
+				if (const size_t o = optionTable().find(name.substr(0, eq)); o != name_table<cmd_option>::npos)
+				{
+					const bool separate = eq == std::string_view::npos;
+					std::string_view value;
+
+					if (!separate)
+						value = name.substr(eq + 1);
+					else if (i + 1 < flags.size())
+						value = flags[++i];
+					else
+						return err(Msg::InvalidOptionValue, std::string(arg));
+
+					auto& v = _result.options[o];
+
+					if (!cmd_options[o]->parse(value, v))
+						return err(Msg::InvalidOptionValue, std::string(arg) + (separate ? " " + std::string(value) : std::string()));
+
+					// The argument may live in an @file mapping that is closed after parsing.
+					if (cmd_options[o]->kind() == OptionKind::String)
+						v.text = *_result.strings.emplace_back(std::make_shared<const std::string>(v.text));
+
+					++countFlags;
+					continue;
+				}
+
+				return err(Msg::UnknownFlag, std::string(arg));
+			}
+
+			if (flag(help) || flag(version))
+			{
+				if (countFlags > 1 || countFiles != 0)
+					return err(Msg::TooManyArguments);
+
+				if (flag(help))
+					return info(Status::Help, text_help());
+
+				return info(Status::Version, std::string(text_version));
+			}
+
+			return true;
+		}
+
+		bool parseSingleFile(const std::vector<std::string_view>& files)
+		{
+			if (files.empty())
+				return err(Msg::NoFileSpecified);
+
+			if (files.size() > 1)
+				return err(Msg::AcceptsOnlyOneFile);
+
+			// Stream mode: source paths are read from stdin by run().
+			if (files.front() == "-")
+			{
+				_result.source = files.front();
+				_result.streaming = true;
+				return true;
+			}
+
+			_result.source = files.front();
+
+			// Source directory mode: accept existing directory, no target required.
+			if (_status.isDirectory(_result.source))
+			{
+				if (files.size() > 1)
+					return err(Msg::TooManyArguments);
+
+				if (!expandDirectory(_result.source))
+					return false;
+
+				if (_compact)
+				{
+					count(Counter::Accepted, _result.work.size());
+					return true;
+				}
+
+				// Single-file mode has no targets; the pairs only carry the sources.
+				for (const auto& file : _result.sources)
+					_result.pairs.push_back({ file, {} });
+
+				count(Counter::Accepted, _result.sources.size());
+				count(Counter::PathsBuilt, _result.sources.size() * 2);
+				return true;
+			}
+
+			// Another node's shard: valid, but nothing to do here (as in batch mode).
+			if (!inShard(files.front()))
+			{
+				dropSinglePair();
+				return true;
+			}
+
+			_result.source = resolveSource(_result.source);
+
+			if (!checkSource(_result.source))
+				return false;
+
+			if (!accept(_result.source, {}))
+				dropSinglePair();
+			return true;
+		}
+
+		bool parseSourceTargetFiles(const std::vector<std::string_view>& files)
+		{
+			if (files.empty())
+				return err(Msg::NoFilesSpecified);
+
+			if (files.size() > 2 && !accept_batch)
+				return err(Msg::AcceptsOnlySourceAndTargetFiles);
+
+			if (files.front() == "-")
+				return parseStream(files);
+
+			_result.source = files.front();
+
+			// Source directory mode: accept existing directory, no target required.
+			if (_status.isDirectory(_result.source))
+			{
+				if (files.size() > 2)
+					return err(Msg::TooManyArguments);
+
+				if (files.size() == 2)
+					return parseMirroredDirectory(files.back());
+
+				if (!expandDirectory(_result.source))
+					return false;
+
+				if (_compact)
+					return compactTargets();
+
+				// Each file is converted next to itself; files that already carry the
+				// default target extension would overwrite themselves and are left out.
+				for (const auto& file : _result.sources)
+				{
+					auto target = defaultTarget(file, file.parent_path());
+					if (isSameFile(file, target))
+						count(Counter::Rejected);
+					else if (!skipUpToDate(file, target))
+						_result.pairs.push_back({ file, std::move(target) });
+				}
+
+				count(Counter::Accepted, _result.pairs.size());
+				count(Counter::PathsBuilt, _result.sources.size() + _result.pairs.size() * 2);
+				return true;
+			}
+
+			if (files.size() > 2)
+				return parseBatchFiles(files);
+
+			// Another node's shard: valid, but nothing to do here (as in batch mode).
+			if (!inShard(files.front()))
+			{
+				dropSinglePair();
+				return true;
+			}
+
+			_result.source = resolveSource(_result.source);
+
+			if (!checkSource(_result.source))
+				return false;
+
+			// Default target is source with default extension.
+			_result.target = defaultTarget(_result.source, _result.source.parent_path());
+
+			if (files.size() == 2)
+			{
+				_result.target = files.back();
+
+				// If target has no extension, interpret it as a directory. Like the target
+				// directory of batch mode, it is relative to the current working directory.
+				if (!hasExtension(files.back()))
+				{
+					if (!_status.isDirectory(_result.target))
+						return err(Msg::TargetDirectoryDoesNotExist, {}, _result.target);
+
+					_result.target = defaultTarget(_result.source, _result.target);
+				}
+				else
+				{
+					// If target has no parent path, treat it as relative to the source directory.
+					if (_result.target.parent_path().empty())
+						_result.target = _result.source.parent_path() / _result.target;
+
+					// If target has a parent path, ensure the parent is a directory.
+					if (!_result.target.parent_path().empty() && !_status.isDirectory(_result.target.parent_path()))
+						return err(Msg::TargetFileUnknownDirectory, {}, _result.target);
+				}
+			}
+
+			if (!checkTarget(_result.source, _result.target))
+				return false;
+
+			if (!accept(_result.source, _result.target))
+				dropSinglePair();
+			return true;
+		}
+
+		// Source directory and target directory: every file maps to the same relative
+		// path below the target directory, with the default target extension.
+		bool parseMirroredDirectory(std::string_view arg)
+		{
+			if (hasExtension(arg))
+				return err(Msg::CannotCombineSourceDirectoryAndTargetFile);
+
+			_result.targetDir = arg;
+
+			if (!_status.isDirectory(_result.targetDir))
+				return err(Msg::TargetDirectoryDoesNotExist, {}, _result.targetDir);
+
+			if (!expandDirectory(_result.source))
+				return false;
+
+			if (_compact)
+				return compactTargets();
+
+			_result.pairs.reserve(_result.sources.size());
+
+			std::filesystem::path parent, dir;
+
+			for (const auto& file : _result.sources)
+			{
+				// Entries of one directory come together, so the relative path is computed once per directory.
+				if (file.parent_path() != parent)
+				{
+					parent = file.parent_path();
+					dir = mirroredDirectory(parent);
+					addDirectory(dir);
+				}
+
+				auto target = defaultTarget(file, dir);
+
+				if (!skipUpToDate(file, target))
+					_result.pairs.push_back({ file, std::move(target) });
+			}
+
+			sortDirectories();
+
+			count(Counter::Accepted, _result.pairs.size());
+			count(Counter::PathsBuilt, _result.sources.size() + _result.pairs.size() * 3);
+			return true;
+		}
+
+		// Directory below the target directory that mirrors the source directory dir.
+		std::filesystem::path mirroredDirectory(const std::filesystem::path& dir) const
+		{
+			const auto relative = dir.lexically_relative(_result.source);
+			return relative == "." ? _result.targetDir : _result.targetDir / relative;
+		}
+
+		// Remembers dir and its parents up to the target directory for createDirectories.
+		void addDirectory(std::filesystem::path dir)
+		{
+			while (dir.native().size() > _result.targetDir.native().size() && dir != _result.targetDir)
+			{
+				_result.directories.push_back(dir);
+				dir = dir.parent_path();
+			}
+		}
+
+		// compactPaths: gives every directory of the work list its target directory (mirrored,
+		// or the directory itself) and leaves out what the full lists leave out. Statuses
+		// are not cached, so memory use stays with the list.
+		bool compactTargets()
+		{
+			auto& work = _result.work;
+			const bool mirror = !_result.targetDir.empty();
+
+			for (size_t d = 0; d < work.directories(); ++d)
+			{
+				if (mirror)
+				{
+					auto dir = mirroredDirectory(work.directory(d));
+					addDirectory(dir);
+					work.targetDirectory(d, std::move(dir));
+				}
+				else
+					work.targetDirectory(d, work.directory(d));
+			}
+
+			sortDirectories();
+
+			// Files next to themselves that already carry the target extension would
+			// overwrite themselves (see parseSourceTargetFiles).
+			if (!mirror || _incremental)
+			{
+				work.keep([&](size_t i)
+					{
+						const auto source = work.source(i);
+						const auto target = work.target(i);
+
+						if (!mirror && isSameFile(source, target))
+						{
+							count(Counter::Rejected);
+							return false;
+						}
+
+						return !skipUpToDate(source, target, false);
+					});
+			}
+
+			count(Counter::Accepted, work.size());
+			count(Counter::PathsBuilt, work.directories() * (mirror ? 2 : 1));
+			return true;
+		}
+
+		// Two pairs with one target would have two workers write the same file. A source
+		// given twice is dropped; different sources with the same target are an error
+		// (with -keepgoing the later ones are recorded in errors and left out).
+		bool dropCollisions()
+		{
+			auto& pairs = _result.pairs;
+			auto& work = _result.work;
+			const bool compact = !work.empty();
+			const size_t n = compact ? work.size() : pairs.size();
+
+			if (n < 2)
+				return true;
+
+			using view = std::basic_string_view<std::filesystem::path::value_type>;
+
+			// The work list derives targets from directory and stem, which identify them
+			// without building a path. Single-file mode has no targets, so sources are compared.
+			auto key = [&](size_t i) -> view
+				{
+					if (compact)
+						return work.stem(i);
+
+					const auto& p = pairs[i];
+					return p.target.empty() ? view(p.source.native()) : view(p.target.native());
+				};
+
+			auto same = [&](size_t i, size_t j)
+				{
+					return key(i) == key(j) && (!compact || work.directoryOf(i) == work.directoryOf(j));
+				};
+
+			std::unordered_multimap<uint64_t, size_t> seen;
+			seen.reserve(n);
+
+			std::vector<bool> drop(n, false);
+			bool dropped = false;
+
+			for (size_t i = 0; i < n; ++i)
+			{
+				const view k = key(i);
+				uint64_t h = hash64(k.data(), k.size() * sizeof(k[0]));
+				if (compact)
+					h ^= work.directoryOf(i) * 0x9e3779b97f4a7c15ull;
+
+				const auto range = seen.equal_range(h);
+				const auto it = std::find_if(range.first, range.second, [&](const auto& e) { return same(e.second, i); });
+
+				if (it == range.second)
+				{
+					seen.emplace(h, i);
+					continue;
+				}
+
+				const bool duplicate = !compact && pairs[it->second].source == pairs[i].source;
+				const auto source = compact ? work.source(i) : pairs[i].source;
+
+				if (!duplicate)
+				{
+					if (!_keepGoing)
+						return err(Msg::TargetCollision, {}, compact ? work.target(i) : pairs[i].target);
+
+					_result.errors.push_back({ Msg::TargetCollision, i, source });
+				}
+
+				drop[i] = true;
+				dropped = true;
+			}
+
+			if (!dropped)
+				return true;
+
+			if (compact)
+			{
+				work.keep([&](size_t i) { return !drop[i]; });
+				return true;
+			}
+
+			// Batch and single sources keep sources and pairs side by side.
+			auto& sources = _result.sources;
+			const bool side = sources.size() == pairs.size();
+
+			size_t kept = 0;
+			for (size_t i = 0; i < n; ++i)
+			{
+				if (drop[i])
+					continue;
+
+				if (side)
+					sources[kept] = std::move(sources[i]);
+
+				pairs[kept++] = std::move(pairs[i]);
+			}
+
+			pairs.resize(kept);
+			if (side)
+				sources.resize(kept);
+
+			return true;
+		}
+
+		// -resume: reads the journal and leaves out the pairs it holds. Stream sources are
+		// checked as they are read (see acceptStreamed).
+		bool resumeFrom(const std::filesystem::path& file)
+		{
+			auto journal = std::make_shared<cmd_journal>();
+			if (!journal->load(file))
+				return err(Msg::JournalNotReadable, {}, file);
+
+			if (journal->size() != 0)
+			{
+				auto& pairs = _result.pairs;
+				const size_t before = pairs.size() + _result.work.size();
+				const bool single = pairs.size() == 1 && pairs.front().source == _result.source;
+
+				pairs.erase(std::remove_if(pairs.begin(), pairs.end(), [&](const cmd_pair& p) { return journal->finished(p); }), pairs.end());
+				_result.work.keep([&](size_t i) { return !journal->finished(_result.work.pair(i)); });
+
+				_result.resumed = before - pairs.size() - _result.work.size();
+
+				if (single && pairs.empty())
+					dropSinglePair();
+			}
+
+			_journal = std::move(journal);
+			return true;
+		}
+
+		// Sorts the directories so every parent comes before its children, each once.
+		void sortDirectories()
+		{
+			auto& dirs = _result.directories;
+			std::sort(dirs.begin(), dirs.end());
+			dirs.erase(std::unique(dirs.begin(), dirs.end()), dirs.end());
+		}
+
+		// Creates the mirrored target directories in one pass, parents first, so workers
+		// never race on creating the same directory.
+		bool createDirectories()
+		{
+			for (const auto& dir : _result.directories)
+			{
+				std::error_code ec;
+				if (!std::filesystem::create_directory(dir, ec) && ec)
+					return runError(Msg::TargetDirectoryNotCreated, dir);
+			}
+
+			_result.directories.clear();
+			return true;
+		}
+
+		// Batch mode: several sources, optionally followed by a target directory.
+		bool parseBatchFiles(const std::vector<std::string_view>& files)
+		{
+			std::filesystem::path targetDir;
+			size_t countSources = files.size();
+
+			// Sources always carry an extension, so a last argument without one is the target directory.
+			if (!hasExtension(files.back()))
+			{
+				targetDir = files.back();
+				--countSources;
+
+				if (!_status.isDirectory(targetDir))
+					return err(Msg::TargetDirectoryDoesNotExist, {}, targetDir);
+			}
+
+			_result.sources.reserve(countSources);
+			_result.pairs.reserve(countSources);
+
+			// Paths first (string work only), then all status queries at once, then the
+			// checks in argument order against the filled cache.
+			std::vector<std::filesystem::path> paths;
+			std::vector<size_t> index;	// argument position of each path, for -keepgoing
+			paths.reserve(countSources * (_incremental ? 2 : 1));
+			index.reserve(countSources);
+
+			for (size_t i = 0; i < countSources; ++i)
+			{
+				if (inShard(files[i]))
+				{
+					paths.push_back(resolveSource(files[i]));
+					index.push_back(i);
+				}
+			}
+
+			countSources = index.size();
+
+			if (_incremental)
+			{
+				for (size_t i = 0; i < countSources; ++i)
+					paths.push_back(defaultTarget(paths[i], targetDir.empty() ? paths[i].parent_path() : targetDir));
+			}
+
+			// openSources: the open handles tell the status of the sources they opened.
+			std::vector<std::shared_ptr<const source_file>> opened;
+			if (_open)
+				opened = openFiles(paths, countSources);
+
+			_status.prefetch(paths, workerCount(paths.size() / prefetch_batch, option(jobs)));
+
+			for (size_t i = 0; i < countSources; ++i)
+			{
+				auto& source = paths[i];
+
+				if (!checkSource(source))
+				{
+					if (keepGoing(index[i], source))
+						continue;
+					return false;
+				}
+
+				auto target = _incremental ? std::move(paths[countSources + i]) :
+					defaultTarget(source, targetDir.empty() ? source.parent_path() : targetDir);
+
+				if (!checkTarget(source, target))
+				{
+					if (keepGoing(index[i], source))
+						continue;
+					return false;
+				}
+
+				accept(std::move(source), std::move(target), _open ? std::move(opened[i]) : nullptr);
+			}
+
+			// Batch mode has no single source and target; use pairs() instead.
+			_result.source.clear();
+			_result.target.clear();
+			return true;
+		}
+
+		// Opens the first count paths on the prefetch threads; a path that cannot be opened
+		// (or is no regular file) gets no handle and no cached status, and the reason in
+		// failed when given.
+		std::vector<std::shared_ptr<const source_file>> openFiles(const std::vector<std::filesystem::path>& paths, size_t count,
+			std::vector<Msg>* failed = nullptr)
+		{
+			std::vector<std::shared_ptr<const source_file>> files(count);
+
+			if (failed)
+				failed->assign(count, Msg::SourceNotFound);
+
+			forEachIndex(count, workerCount(count / prefetch_batch, option(jobs)), [&](size_t i)
+				{
+					auto file = std::make_shared<source_file>();
+					if (file->open(paths[i], _map))
+						files[i] = std::move(file);
+					else if (failed)
+						(*failed)[i] = openError(*file);
+				});
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (files[i])
+					_status.store(paths[i], files[i]->info());
+			}
+
+			return files;
+		}
+
+		// openSources: opens the accepted sources that have no handle yet (directory and
+		// single-file modes). A source that cannot be opened is rejected with the cause
+		// (missing, not readable, too many open files).
+		bool openPairs()
+		{
+			std::vector<std::filesystem::path> paths;
+			std::vector<size_t> missing;
+
+			for (size_t i = 0; i < _result.pairs.size(); ++i)
+			{
+				if (!_result.pairs[i].file)
+				{
+					paths.push_back(_result.pairs[i].source);
+					missing.push_back(i);
+				}
+			}
+
+			std::vector<Msg> failed;
+			auto files = openFiles(paths, paths.size(), &failed);
+			size_t lost = 0;
+
+			for (size_t i = 0; i < missing.size(); ++i)
+			{
+				auto& pair = _result.pairs[missing[i]];
+
+				if (files[i])
+				{
+					pair.file = std::move(files[i]);
+					continue;
+				}
+
+				reject(failed[i], pair.source);
+
+				if (!keepGoing(missing[i], pair.source))
+					return false;
+
+				pair.source.clear();
+				++lost;
+			}
+
+			if (lost)
+			{
+				auto& pairs = _result.pairs;
+				pairs.erase(std::remove_if(pairs.begin(), pairs.end(), [](const cmd_pair& p) { return p.source.empty(); }), pairs.end());
+			}
+
+			return true;
+		}
+
+		// -shard=i/n, with 0 <= i < n; no value means no sharding.
+		bool parseShard(std::string_view value)
+		{
+			_shard = 0;
+			_shards = 1;
+
+			if (value.empty())
+				return true;
+
+			const size_t slash = value.find('/');
+			if (slash == std::string_view::npos)
+				return false;
+
+			uint64_t i = 0, n = 0;
+			const char* end = value.data() + value.size();
+
+			const auto ri = std::from_chars(value.data(), value.data() + slash, i);
+			const auto rn = std::from_chars(value.data() + slash + 1, end, n);
+
+			if (ri.ec != std::errc() || ri.ptr != value.data() + slash || rn.ec != std::errc() || rn.ptr != end || i >= n)
+				return false;
+
+			_shard = i;
+			_shards = n;
+			return true;
+		}
+
+		// True when a source belongs to this node's shard. The path is hashed as given on the
+		// command line (or relative to the source directory), so every node that runs the same
+		// command line agrees on the split without a coordinator. Runs before any status call.
+		template <class C>
+		bool inShard(std::basic_string_view<C> p) const
+		{
+			return _shards <= 1 || shardHash(p) % _shards == _shard;
+		}
+
+		// FNV-1a over the path characters with a final mix; \ counts as / so that the same
+		// (ASCII) relative path lands in the same shard on every platform.
+		template <class C>
+		static uint64_t shardHash(std::basic_string_view<C> p)
+		{
+			uint64_t h = 14695981039346656037ull;
+			for (const C ch : p)
+			{
+				const auto c = static_cast<uint64_t>(static_cast<std::make_unsigned_t<C>>(ch == '\\' ? '/' : ch));
+				h = (h ^ c) * 1099511628211ull;
+			}
+
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdull;
+			h ^= h >> 33;
+			return h;
+		}
+
+		// -largestfirst: sorts the pairs by source size, largest first (LPT scheduling), so a
+		// big file that would otherwise start last does not set the wall-clock time. Batch
+		// sources are sized from the stat validation already made; directory entries get
+		// one stat each here. Equal sizes keep their order.
+		void orderLargestFirst()
+		{
+			if (!_result.work.empty())
+				return orderLargestFirst(_result.work);
+
+			auto& pairs = _result.pairs;
+			if (pairs.size() < 2)
+				return;
+
+			std::vector<std::pair<uintmax_t, size_t>> order;
+			order.reserve(pairs.size());
+
+			for (size_t i = 0; i < pairs.size(); ++i)
+				order.emplace_back(_status.info(pairs[i].source).size, i);
+
+			std::stable_sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+			std::vector<cmd_pair> sorted;
+			sorted.reserve(pairs.size());
+
+			for (const auto& o : order)
+				sorted.push_back(std::move(pairs[o.second]));
+
+			pairs = std::move(sorted);
+		}
+
+		void orderLargestFirst(cmd_worklist& work)
+		{
+			std::vector<std::pair<uintmax_t, size_t>> order;
+			order.reserve(work.size());
+
+			for (size_t i = 0; i < work.size(); ++i)
+				order.emplace_back(_status.info(work.source(i), false).size, i);
+
+			std::stable_sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+			std::vector<size_t> positions;
+			positions.reserve(order.size());
+
+			for (const auto& o : order)
+				positions.push_back(o.second);
+
+			work.reorder(positions);
+		}
+
+		// Stream mode: "-" reads the sources from stdin, optionally followed by a target directory.
+		bool parseStream(const std::vector<std::string_view>& files)
+		{
+			if (files.size() > 2)
+				return err(Msg::AcceptsOnlySourceAndTargetFiles);
+
+			if (files.size() == 2)
+			{
+				_result.targetDir = files.back();
+
+				if (hasExtension(files.back()) || !_status.isDirectory(_result.targetDir))
+					return err(Msg::TargetDirectoryDoesNotExist, {}, _result.targetDir);
+			}
+
+			_result.source = files.front();
+			_result.streaming = true;
+			return true;
+		}
+
+		// Validates one source path read in stream mode. The statuses are not cached, so
+		// memory use does not grow with the length of the stream.
+		bool acceptStreamed(std::string_view line, cmd_pair& pair)
+		{
+			if (!inShard(line))
+			{
+				pair = {};
+				return true;
+			}
+
+			auto source = resolveSource(std::filesystem::path(line));
+
+			if (!checkSource(source, false))
+				return false;
+
+			std::filesystem::path target;
+
+			if (!target_ext.empty())
+			{
+				target = defaultTarget(source, _result.targetDir.empty() ? source.parent_path() : _result.targetDir);
+
+				if (!checkTarget(source, target))
+					return false;
+			}
+
+			// An up-to-date or already finished source is valid, but hands out no pair.
+			if (skipUpToDate(source, target, false))
+			{
+				pair = {};
+				return true;
+			}
+
+			if (_journal && _journal->finished({ source, target }))
+			{
+				++_result.resumed;
+				pair = {};
+				return true;
+			}
+
+			std::shared_ptr<const source_file> file;
+
+			if (_open)
+			{
+				auto opened = std::make_shared<source_file>();
+				if (!opened->open(source, _map))
+					return reject(openError(*opened), source);
+
+				file = std::move(opened);
+			}
+
+			count(Counter::Accepted);
+			pair = { std::move(source), std::move(target), std::move(file) };
+			pair.conversion = conversionOf(pair.source, pair.target);
+			return true;
+		}
+
+		// Reads source paths from stdin on the calling thread and hands each accepted
+		// pair to the workers at once, through a queue of bounded size. The first
+		// invalid path stops the stream (with -keepgoing it is recorded and skipped);
+		// pairs already handed out are finished.
+		bool runStream(const pair_callback& fn, const cmd_cancel* cancel)
+		{
+			const size_t count = workerCount(static_cast<size_t>(-1), option(jobs));
+
+			pair_queue queue(count * 4);
+			std::atomic<bool> ok{ true };
+			std::atomic<bool> cancelled{ false };
+			std::atomic_flag failed = ATOMIC_FLAG_INIT;
+			std::exception_ptr error;
+
+			auto worker = [&]()
+				{
+					for (cmd_pair pair; queue.pop(pair);)
+					{
+						if (cancel && cancel->cancelled())
+						{
+							ok = false;
+							cancelled = true;
+							queue.cancel();
+							break;
+						}
+
+						try
+						{
+							if (!fn(pair))
+								ok = false;
+						}
+						catch (...)
+						{
+							if (!failed.test_and_set())
+								error = std::current_exception();
+
+							ok = false;
+							cancelled = true;
+							queue.cancel();
+						}
+					}
+				};
+
+			std::vector<std::thread> threads;
+			threads.reserve(count);
+
+			for (size_t i = 0; i < count; ++i)
+				threads.emplace_back(worker);
+
+			bool valid = true;
+			std::string line;
+
+			for (size_t index = 0; valid && !cancelled && readLine(stdin, line); ++index)
+			{
+				if (cancel && cancel->cancelled())
+				{
+					ok = false;
+					break;
+				}
+
+				if (line.empty())
+					continue;
+
+				cmd_pair pair;
+				valid = acceptStreamed(line, pair) || keepGoing(index, std::filesystem::path(line));
+
+				if (valid && !pair.source.empty())
+				{
+					// The queue is the lookahead here: a source is hinted when it is queued.
+					if (option(readahead) > 0)
+						willNeed(pair);
+
+					queue.push(std::move(pair));
+				}
+			}
+
+			queue.close();
+
+			for (auto& t : threads)
+				t.join();
+
+			flushInstrumentation();
+
+			if (error)
+				std::rethrow_exception(error);
+
+			if (_mode == Mode::Global)
+			{
+				if (!valid)
+					report();
+				else if (!_result.errors.empty())
+					reportErrors();
+			}
+
+			return valid && ok;
+		}
+
+		// -plan: writes a record per pair to stdout instead of running fn, so an external
+		// scheduler gets the validated sources and derived targets without stat'ing them
+		// again. Stream sources are written as they are read; with -watch the changed
+		// sources follow as they come.
+		bool runPlan(directory_watch& watcher, const cmd_cancel* cancel)
+		{
+			plan_writer out(static_cast<PlanFormat>(option(plan)));
+
+			bool valid = true;
+
+			if (_result.streaming)
+			{
+				std::string line;
+
+				for (size_t index = 0; valid && !(cancel && cancel->cancelled()) && readLine(stdin, line); ++index)
+				{
+					if (line.empty())
+						continue;
+
+					cmd_pair pair;
+					valid = acceptStreamed(line, pair) || keepGoing(index, std::filesystem::path(line));
+
+					if (valid && !pair.source.empty())
+						out.write(pair, planSize(pair));
+				}
+			}
+			else if (!_result.work.empty())
+				writePlan(out, _result.work.size(), [&](size_t i) { return _result.work.pair(i); });
+			else
+				writePlan(out, _result.pairs.size(), [&](size_t i) -> const cmd_pair& { return _result.pairs[i]; });
+
+			bool ok = out.flush();
+
+			if (_result.streaming && _mode == Mode::Global)
+			{
+				if (!valid)
+					report();
+				else if (!_result.errors.empty())
+					reportErrors();
+			}
+
+			if (flag(watch))
+			{
+				std::mutex mutex;
+
+				ok = runWatch(watcher, [&](const cmd_pair& pair)
+					{
+						const uint64_t size = planSize(pair);
+
+						std::lock_guard<std::mutex> lock(mutex);
+						out.write(pair, size);
+						return out.flush();
+					}, cancel) && ok;
+			}
+
+			return valid && ok;
+		}
+
+		// Writes the records of n pairs in order. The sizes of a block are looked up on
+		// -jobs threads first, since directory entries still cost a stat each.
+		template <class At>
+		void writePlan(plan_writer& out, size_t n, At at)
+		{
+			constexpr size_t block = 4096;
+			std::vector<uint64_t> sizes;
+
+			for (size_t begin = 0; begin < n; begin += block)
+			{
+				const size_t count = (std::min)(block, n - begin);
+				sizes.assign(count, 0);
+
+				forEachIndex(count, workerCount(count / prefetch_batch, option(jobs)), [&](size_t i) { sizes[i] = planSize(at(begin + i)); });
+
+				for (size_t i = 0; i < count; ++i)
+					out.write(at(begin + i), sizes[i]);
+			}
+		}
+
+		// Source size from the open file or a status the validation already cached, else one stat.
+		uint64_t planSize(const cmd_pair& pair) const
+		{
+			if (pair.file)
+				return pair.file->size();
+
+			if (const file_info* info = _status.cached(pair.source))
+				return info->size;
+
+			return statFile(pair.source).size;
+		}
+
+		bool planning() const { return option(plan) != static_cast<long long>(PlanFormat::None); }
+
+		// One run over the parsed sources: the stream, the compact work list or the pairs.
+		bool runOnce(const pair_callback& fn, const cmd_cancel* cancel)
+		{
+			if (_result.streaming)
+				return runStream(fn, cancel);
+
+			if (!_result.work.empty())
+				return cmd::run(_result.work, fn, option(jobs), cancel, option(readahead));
+
+			return cmd::run(_result.pairs, fn, option(jobs), cancel, option(readahead));
+		}
+
+		// -watch: runs fn over the sources that are created or modified below the source
+		// directory, one batch per burst of changes, until cancel is set. A changed file
+		// goes through the rules of the first run: source extensions, -shard, target
+		// derivation (mirrored or next to the source) and -incremental.
+		bool runWatch(directory_watch& watcher, const pair_callback& fn, const cmd_cancel* cancel)
+		{
+			bool ok = true;
+			std::vector<std::filesystem::path> changed;
+			std::vector<cmd_pair> batch;
+
+			while (!(cancel && cancel->cancelled()))
+			{
+				changed.clear();
+				if (!watcher.wait(changed, watch_interval))
+					return runError(Msg::SourceDirectoryNotWatched, _result.source);
+
+				// The statuses seen so far are from before the change.
+				_status.clear();
+				batch.clear();
+
+				for (auto& file : changed)
+				{
+					cmd_pair pair;
+					if (acceptWatched(std::move(file), pair))
+						batch.push_back(std::move(pair));
+				}
+
+				if (batch.empty())
+					continue;
+
+				sortDirectories();
+				if (planning())
+					_result.directories.clear();
+				else if (!createDirectories())
+					return false;
+
+				ok = cmd::run(batch, fn, option(jobs), cancel, option(readahead)) && ok;
+
+				if (_manifest)
+					ok = _manifest->save() && ok;
+			}
+
+			return ok;
+		}
+
+		// Pair for a file reported by the watch; false when it is not a source to convert.
+		bool acceptWatched(std::filesystem::path file, cmd_pair& pair)
+		{
+			// Targets mirrored into a directory inside the source directory are not sources.
+			if (inTargetDirectory(file))
+				return false;
+
+			std::error_code ec;
+			if (!sourceExtensions().contains(file) || !inShard(relativeName(file.native(), _result.source.native().size())) ||
+				!std::filesystem::is_regular_file(file, ec))
+				return false;
+
+			std::filesystem::path target;
+
+			if (!target_ext.empty())
+			{
+				if (_result.targetDir.empty())
+					target = defaultTarget(file, file.parent_path());
+				else
+				{
+					auto dir = mirroredDirectory(file.parent_path());
+					target = defaultTarget(file, dir);
+					addDirectory(std::move(dir));
+				}
+
+				// A target written next to its source must not come back as a source.
+				if (isSameFile(file, target))
+					return false;
+			}
+
+			if (skipUpToDate(file, target, false))
+				return false;
+
+			std::shared_ptr<const source_file> opened;
+
+			if (_open)
+			{
+				auto f = std::make_shared<source_file>();
+				if (!f->open(file, _map))
+					return false;
+
+				opened = std::move(f);
+			}
+
+			count(Counter::Accepted);
+			pair = { std::move(file), std::move(target), std::move(opened) };
+			pair.conversion = conversionOf(pair.source, pair.target);
+			return true;
+		}
+
+		// If source has no parent path, treat it as relative to the current working directory.
+		std::filesystem::path resolveSource(std::filesystem::path source)
+		{
+			if (!source.parent_path().empty())
+				return source;
+
+			if (_cwd.empty())
+				_cwd = std::filesystem::current_path();
+
+			auto resolved = _cwd / source;
+			_status.alias(source, resolved);
+			return resolved;
+		}
+
+		bool checkSource(const std::filesystem::path& source, bool remember = true)
+		{
+			phase_scope scope(*this, Phase::Validation);
+
+			if (!_status.exists(source, remember))
+				return reject(Msg::SourceNotFound, source);
+
+			if (!sourceExtensions().contains(source))
+				return reject(Msg::SourceInvalidExtension, source);
+
+			return true;
+		}
+
+		bool checkTarget(const std::filesystem::path& source, const std::filesystem::path& target)
+		{
+			phase_scope scope(*this, Phase::Validation);
+
+			if (isSameFile(source, target))
+				return reject(Msg::SourceAndTargetAreSame, {});
+
+			if (!targetExtensions().contains(target))
+				return reject(Msg::TargetInvalidExtension, target);
+
+			return true;
+		}
+
+		// The message for a source that could not be opened, by the cause of the failure
+		static Msg openError(const source_file& file)
+		{
+			const auto& e = file.error();
+
+			if (e == std::errc::too_many_files_open || e == std::errc::too_many_files_open_in_system)
+				return Msg::TooManyOpenFiles;
+
+			if (!e || e == std::errc::no_such_file_or_directory || e == std::errc::not_a_directory)
+				return Msg::SourceNotFound;
+
+			return Msg::SourceNotReadable;
+		}
+
+		bool reject(Msg m, const std::filesystem::path& p)
+		{
+			count(Counter::Rejected);
+			_rejected = m;
+			return err(m, {}, p);
+		}
+
+		// -keepgoing: turns the error of the source just rejected into a record, so that
+		// parsing goes on with the next source. Returns false without -keepgoing.
+		bool keepGoing(size_t index, const std::filesystem::path& source)
+		{
+			if (!_keepGoing)
+				return false;
+
+			_result.errors.push_back({ _rejected, index, source });
+			_result.status = Status::Ok;
+			_result.message.clear();
+			return true;
+		}
+
+		// -incremental: make-style check that leaves out a pair whose target exists and is
+		// not older than its source. An empty target only counts when the source is empty
+		// too, so a conversion that died after creating its output is redone. With a
+		// manifest attached, the source is compared against its recorded state instead.
+		bool skipUpToDate(const std::filesystem::path& source, const std::filesystem::path& target, bool remember = true)
+		{
+			if (!_incremental || target.empty())
+				return false;
+
+			const file_info t = _status.info(target, remember);
+			if (!std::filesystem::is_regular_file(t.status))
+				return false;
+
+			const file_info& s = _status.info(source, remember);
+
+			if (_manifest)
+			{
+				if (!_manifest->unchanged({ source, target }, s))
+					return false;
+			}
+			else if (t.mtime < s.mtime || (t.size == 0 && s.size != 0))
+				return false;
+
+			count(Counter::UpToDate);
+			++_result.upToDate;
+			return true;
+		}
+
+		// Stores an accepted source and its target (empty in single-file mode).
+		// Returns false when -incremental left the pair out.
+		bool accept(std::filesystem::path source, std::filesystem::path target, std::shared_ptr<const source_file> file = nullptr)
+		{
+			if (skipUpToDate(source, target))
+				return false;
+
+			count(Counter::Accepted);
+			count(Counter::PathsBuilt, target.empty() ? 2 : 3);
+
+			_result.sources.push_back(source);
+			_result.pairs.push_back({ std::move(source), std::move(target), std::move(file) });
+			return true;
+		}
+
+		// Single source and target: a pair that is left out (up to date, finished in the
+		// journal, another shard) leaves no source()/target() behind to convert.
+		void dropSinglePair()
+		{
+			_result.source.clear();
+			_result.target.clear();
+		}
+
+		// Target in the given directory, named after the source with the default target extension.
+		std::filesystem::path defaultTarget(const std::filesystem::path& source, const std::filesystem::path& dir)
+		{
+			phase_scope scope(*this, Phase::TargetDerivation);
+
+			auto target = dir / source.filename();
+			target.replace_extension(defaultTargetExt());
+			return target;
+		}
+
+		// Case-insensitive (ASCII) compare of the native path strings, without lowercase copies.
+		static bool isSameFile(const std::filesystem::path& source, const std::filesystem::path& target)
+		{
+			const auto& a = source.native();
+			const auto& b = target.native();
+
+			auto lower = [](auto c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; };
+
+			return a.size() == b.size() &&
+				std::equal(a.begin(), a.end(), b.begin(), [&](auto x, auto y) { return lower(x) == lower(y); });
+		}
+
+		// Same rule as path::has_extension, applied to the argument text without creating a path.
+		static bool hasExtension(std::string_view arg)
+		{
+			size_t start = arg.size();
+			while (start > 0 && !isSeparator(arg[start - 1]))
+				--start;
+
+			const auto name = arg.substr(start);
+			const size_t dot = name.rfind('.');
+
+			return dot != std::string_view::npos && dot != 0 && name != "..";
+		}
+
+		// Strips the leading - or -- from a flag argument.
+		static std::string_view flagName(std::string_view arg)
+		{
+			return arg.substr(arg.compare(0, 2, "--") == 0 ? 2 : 1);
+		}
+
+		// Expands a source directory into the files that carry a source extension.
+		// The iterator already knows each entry's type, so the only filesystem call per
+		// entry is the directory read itself (plus a stat for symlinks).
+		bool expandDirectory(const std::filesystem::path& dir)
+		{
+			namespace fs = std::filesystem;
+
+			phase_scope scope(*this, Phase::DirectoryExpansion);
+
+			std::error_code ec;
+			const auto options = fs::directory_options::skip_permission_denied;
+			const size_t root = dir.native().size();
+
+			if (flag(recursive))
+			{
+				// A target directory inside the source tree holds the targets of earlier runs; it is not walked.
+				const bool nested = inTargetDirectory(_result.targetDir, dir) && !isTargetDirectory(dir);
+
+				for (fs::recursive_directory_iterator it(dir, options, ec), end; !ec && it != end; it.increment(ec))
+				{
+					if (nested && it->is_directory(ec) && isTargetDirectory(it->path()))
+						it.disable_recursion_pending();
+					else
+						addDirectoryEntry(*it, root);
+				}
+			}
+			else
+			{
+				for (fs::directory_iterator it(dir, options, ec), end; !ec && it != end; it.increment(ec))
+					addDirectoryEntry(*it, root);
+			}
+
+			if (ec)
+				return err(Msg::SourceDirectoryNotReadable, {}, dir);
+
+			// -resume: the same tree expands in the same order every run, whatever order the
+			// system lists the entries in. Files of one directory stay together.
+			if (!text(resume).empty())
+			{
+				if (_compact)
+					_result.work.sort();
+				else
+					std::sort(_result.sources.begin(), _result.sources.end(), [](const auto& a, const auto& b) { return pathOrder(a.native(), b.native()); });
+			}
+
+			return true;
+		}
+
+		// Orders paths by directory, then by file name.
+		static bool pathOrder(std::basic_string_view<std::filesystem::path::value_type> a, std::basic_string_view<std::filesystem::path::value_type> b)
+		{
+			const auto split = [](auto p)
+				{
+					size_t i = p.size();
+					while (i > 0 && !isSeparator(p[i - 1]))
+						--i;
+					return i;
+				};
+
+			const size_t x = split(a), y = split(b);
+			const auto dirA = a.substr(0, x), dirB = b.substr(0, y);
+
+			return dirA != dirB ? dirA < dirB : a.substr(x) < b.substr(y);
+		}
+
+		// Absolute, normalized spelling of a path for comparisons (no trailing separator).
+		static std::filesystem::path normalPath(const std::filesystem::path& p)
+		{
+			std::error_code ec;
+			auto n = std::filesystem::absolute(p, ec).lexically_normal();
+			if (!n.has_filename() && n.has_relative_path())
+				n = n.parent_path();
+			return n;
+		}
+
+		// True when p is dir or lies below it.
+		static bool inTargetDirectory(const std::filesystem::path& p, const std::filesystem::path& dir)
+		{
+			if (dir.empty())
+				return false;
+
+			const auto relative = normalPath(p).lexically_relative(normalPath(dir));
+			return !relative.empty() && *relative.begin() != "..";
+		}
+
+		// True when p is the mirrored target directory or lies below it.
+		bool inTargetDirectory(const std::filesystem::path& p) const { return inTargetDirectory(p, _result.targetDir); }
+
+		bool isTargetDirectory(const std::filesystem::path& dir) const
+		{
+			return !_result.targetDir.empty() && normalPath(dir) == normalPath(_result.targetDir);
+		}
+
+		// root is the length of the directory path that starts every entry path.
+		void addDirectoryEntry(const std::filesystem::directory_entry& entry, size_t root)
+		{
+			count(Counter::DirectoryEntries);
+
+			// The extension and shard tests are pure string work, so they run before the entry status is queried.
+			std::error_code ec;
+			if (!sourceExtensions().contains(entry.path()) || !inShard(relativeName(entry.path().native(), root)) || !entry.is_regular_file(ec))
+				count(Counter::Rejected);
+			else if (_compact)
+				_result.work.add(entry.path());
+			else
+				_result.sources.push_back(entry.path());
+		}
+
+		// Entry path below the expanded directory, as a view (without the leading separator)
+		static std::basic_string_view<std::filesystem::path::value_type> relativeName(const std::filesystem::path::string_type& p, size_t root)
+		{
+			std::basic_string_view<std::filesystem::path::value_type> v(p);
+			v.remove_prefix((std::min)(root, v.size()));
+
+			while (!v.empty() && isSeparator(v.front()))
+				v.remove_prefix(1);
+
+			return v;
+		}
+
+		// Paths per prefetch thread; below this a thread costs more than the status calls it overlaps
+		static constexpr size_t prefetch_batch = 64;
+
+		// -watch: how long one wait for changes lasts before cancel is checked again (the
+		// fallback rescans the tree only every -rescan interval, see directory_watch::rescan)
+		static constexpr std::chrono::milliseconds watch_interval{ 250 };
+
+		Mode _mode = Mode::Global;
+		cmd_result _result;
+		status_cache _status;
+		std::filesystem::path _cwd;
+		bool _incremental = false;
+		bool _keepGoing = false;
+		bool _open = false;	// see openSources
+		bool _map = false;
+		bool _compact = false;	// see compactPaths
+		uint64_t _shard = 0;	// -shard=i/n: this node's shard i of _shards
+		uint64_t _shards = 1;
+		Msg _rejected = Msg::SourceNotFound;	// reason of the last reject(), for keepGoing
+		cmd_manifest* _manifest = nullptr;
+		std::shared_ptr<cmd_journal> _journal;	// -resume
+
+#ifdef CMDARGS_INSTRUMENT
+		cmd_sink* _sink = nullptr;
+		std::array<std::chrono::nanoseconds, static_cast<size_t>(Phase::Count)> _phases{};
+		std::array<uint64_t, static_cast<size_t>(Counter::Count)> _counters{};
+#endif
+	};
+
+	//---------------------------------------------------------------------------------------------------------
+	// Command-line Argument Parser for Global Parsing
+	//---------------------------------------------------------------------------------------------------------
+
+	// The parser behind cmd::parse and cmd::run
+	inline CmdArgumentParser& globalParser()
+	{
+		static CmdArgumentParser parser;
+		return parser;
+	}
+
+	inline bool parse(int argc, char* argv[])
+	{
+		return globalParser().parse(argc, argv);
+	}
+
+	// Runs fn over the globally parsed pairs on -jobs worker threads
+	inline bool run(const pair_callback& fn)
+	{
+		return globalParser().run(fn);
+	}
 
-	static bool parse(int argc, char* argv[])
+	// Runs fn over every accepted (source, target) pair of a parser on its -jobs
+	// work-stealing workers (all cores by default). Returns false when a call failed or
+	// the run was cancelled; an exception thrown by fn stops the run and is rethrown.
+	inline bool for_each_source(CmdArgumentParser& parser, const pair_callback& fn, const cmd_cancel* cancel = nullptr)
 	{
-		CmdArgumentParser command;
-		return command.parse(argc, argv);
+		return parser.run(fn, cancel);
 	}
 }